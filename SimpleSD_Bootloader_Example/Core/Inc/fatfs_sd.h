@@ -26,4 +26,20 @@ DRESULT SD_disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
 #define SPI_TIMEOUT 1000
 
+/* SPI transfer backends */
+#define SD_SPI_BACKEND_HAL      0   /* HAL_SPI_Transmit/HAL_SPI_TransmitReceive per transfer */
+#define SD_SPI_BACKEND_REGISTER 1   /* Direct DR/TXE/RXNE access */
+
+/* Select the SPI transfer backend */
+#define SD_SPI_BACKEND SD_SPI_BACKEND_REGISTER
+
+/* Use SPI DMA for the data phase of the 512 byte data blocks */
+#define SD_SPI_USE_DMA 1
+
+/* Smallest data block transferred with DMA, shorter blocks (CSD/CID) use the byte path */
+#define SD_DMA_MIN_SIZE 512
+
+/* Time to wait for a DMA block transfer [ms] */
+#define SD_DMA_TIMEOUT 100
+
 #endif
@@ -15,25 +15,268 @@
 #include "SimpleSD_bootloader.h"
 #include "stm32f4xx_hal_flash_ex.h"
 #include "fatfs.h"
+#include <string.h>
 
 #if CRC_CALCULATION_METHOD
 #include "stm32f4xx_hal_crc.h"
 extern CRC_HandleTypeDef hcrc;
+
+/* DMA2 memory-to-memory stream feeding the CRC peripheral */
+static DMA_HandleTypeDef SimpleSD_hdma_crc;
 #endif
 
 #if SD_WATCHDOG_RUNNING
 extern IWDG_HandleTypeDef hiwdg;
 #endif
 
+#if CRC_CALCULATION_METHOD == CRC_USING_FUNCTION
+#if SIMPLESD_CRC_TABLE_LOCATION == SIMPLESD_CRC_TABLE_FLASH
+#include "SimpleSD_crc_table.h"
+_Static_assert(SIMPLESD_CRC_TABLE_POLYNOMIAL == CRC_POLYNOMIAL, "Generate SimpleSD_crc_table.h for CRC_POLYNOMIAL");
+#else
+/* Slicing tables of the software CRC, built by SimpleSD_CRC_TableInit() */
+#if SIMPLESD_CRC_TABLE_LOCATION == SIMPLESD_CRC_TABLE_CCMRAM
+__attribute__((section(".ccmram")))
+#endif
+static uint32_t SimpleSD_CRC_Table[SIMPLESD_CRC_SLICES][256];
+static uint8_t SimpleSD_CRC_TableReady;
+static void SimpleSD_CRC_TableInit(void);
+#endif
+#endif
+
 static FATFS FileSystem;   // FileSystem
 static FIL SimpleSD_file;  // SD file
 static FRESULT fresult;    // Result
 
+/* Staging buffers for the firmware file. Word aligned, so FatFs can read whole sectors straight into them.
+ * With the pipeline enabled one buffer is programmed while the other one is filled from the SD card */
+static uint32_t SimpleSD_ReadBuffer[SIMPLESD_READ_BUFFERS][SIMPLESD_READ_BUFFER_SIZE/4];
+
+#if SIMPLESD_ERASE_OVERLAP
+/* Read-ahead buffer filled while sectors are erased. It holds the file from the flash address
+ * Prefetch_Start to Prefetch_End, reading stops at Prefetch_Limit */
+static uint32_t SimpleSD_PrefetchBuffer[SIMPLESD_PREFETCH_SIZE/4];
+static uint32_t Prefetch_Start;
+static uint32_t Prefetch_End;
+static uint32_t Prefetch_Limit;
+#endif
+
+/* Programming parallelism, the widest one the voltage range allows */
+#if SIMPLESD_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_1
+	#define SIMPLESD_PROGRAM_PSIZE FLASH_PSIZE_BYTE
+#elif SIMPLESD_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_2
+	#define SIMPLESD_PROGRAM_PSIZE FLASH_PSIZE_HALF_WORD
+#elif SIMPLESD_VOLTAGE_RANGE == FLASH_VOLTAGE_RANGE_3
+	#define SIMPLESD_PROGRAM_PSIZE FLASH_PSIZE_WORD
+#else
+	#define SIMPLESD_PROGRAM_PSIZE FLASH_PSIZE_DOUBLE_WORD
+#endif
+
+#if SIMPLESD_PIPELINE_ENABLED && (SIMPLESD_PROGRAM_PSIZE < FLASH_PSIZE_WORD)
+	#error "SIMPLESD_PIPELINE_ENABLED requires SIMPLESD_VOLTAGE_RANGE FLASH_VOLTAGE_RANGE_3 or FLASH_VOLTAGE_RANGE_4"
+#endif
+
+#define SIMPLESD_FLASH_ERRORS (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR)
+
+/* State of the flash programmer */
+static const uint32_t *volatile Program_Data;
+static volatile uint32_t Program_Address;
+static volatile uint32_t Program_Remaining;
+static volatile uint32_t Program_Step;
+/* Block handed to the programmer, verified by SimpleSD_ProgramWait() once it is programmed */
+static uint32_t Program_BlockAddress;
+static const uint32_t *Program_BlockData;
+static uint32_t Program_BlockWords;
+static volatile uint8_t  Program_Status;
+static volatile uint32_t Program_StartTime;
+static volatile uint8_t  Program_Erase;
+
+/* Flash from this address on has not been erased yet, sectors are erased when the
+ * programming reaches them [SIMPLESD_ERASE_JUST_IN_TIME, SIMPLESD_DIFFERENTIAL] */
+static uint32_t Erase_Next;
+
+/* Slot the image is installed to and address of its CRC word */
+static uint32_t Image_Base;
+static uint32_t Image_CRCAddress;
+
+#if SIMPLESD_DUAL_BANK
+/* Slot holding the firmware to boot, 0 if not known yet */
+static uint32_t Slot_Active;
+#endif
+
+#if SIMPLESD_BLOCK_CRC
+/* Largest block CRC table of an image filling the application area */
+#define SIMPLESD_IMAGE_MAX_BLOCKS (APPLICATION_MAX_SIZE / SIMPLESD_IMAGE_BLOCK_SIZE + 1)
+
+/* Block CRC table of the image being installed, read from the file. Block_Count is 0 if the image has none */
+static uint32_t Block_CRC[SIMPLESD_IMAGE_MAX_BLOCKS];
+static uint32_t Block_Count;
+static uint32_t Block_TableOffset;
+#endif
+
+#if SIMPLESD_LZ4
+/* Compressed firmware file: a header [SIMPLESD_LZ4_MAGIC, image size, block size, number of blocks], the file
+ * offsets of the blocks and of the end of the file, then the LZ4 blocks. A block as long as its uncompressed
+ * data is stored uncompressed */
+#define SIMPLESD_LZ4_HEADER_SIZE 16
+#define SIMPLESD_LZ4_MAX_BLOCKS (APPLICATION_MAX_SIZE / SIMPLESD_LZ4_BLOCK_SIZE + 1)
+
+/* Block index of the opened file and position in the image it holds */
+static uint8_t  Lz4_Enabled;
+static uint32_t Lz4_Size;
+static uint32_t Lz4_BlockSize;
+static uint32_t Lz4_Blocks;
+static uint32_t Lz4_Position;
+static uint32_t Lz4_Loaded;
+static uint32_t Lz4_Index[SIMPLESD_LZ4_MAX_BLOCKS + 1];
+
+/* Compressed block read from the file and decompressed block read in parts */
+static uint32_t Lz4_Input[SIMPLESD_LZ4_BLOCK_SIZE / 4];
+static uint32_t Lz4_Output[SIMPLESD_LZ4_BLOCK_SIZE / 4];
+#endif
+
+#if SIMPLESD_DELTA
+/* Patch: a header [SIMPLESD_DELTA_MAGIC, CRC word and size of the base image, size of the new image with its CRC],
+ * then records of a control [diff length, extra length, seek], the diff bytes added to the base image and the extra
+ * bytes copied to the new image. The seek moves in the base image after the record */
+#define SIMPLESD_DELTA_HEADER_SIZE 16
+
+/* Patch applied to the firmware in the active slot, positions in the new image, the base image and the patch */
+static uint8_t  Delta_Enabled;
+static uint32_t Delta_Base;
+static uint32_t Delta_BaseSize;
+static uint32_t Delta_Size;
+static uint32_t Delta_Position;
+static uint32_t Delta_Old;
+static uint32_t Delta_Stream;
+
+/* Control of the record being applied */
+static uint32_t Delta_Diff;
+static uint32_t Delta_Extra;
+static int32_t  Delta_Seek;
+#endif
+
+#if SIMPLESD_FAST_BOOT || SIMPLESD_VERIFIED_STAMP || SIMPLESD_JOURNAL
+/* RTC backup register, kept through resets while VDD or VBAT is present */
+#define SIMPLESD_BKP_REGISTER(Index) ((&RTC->BKP0R)[Index])
+#endif
+
+#if SIMPLESD_JOURNAL
+/* Progress of the journal with nothing to resume, otherwise the address the image is programmed and verified up to */
+#define SIMPLESD_JOURNAL_DONE ((uint32_t)0x00000000)
+
+/* CRC word of the image being installed */
+static uint32_t Journal_Image;
+#endif
+
+/* Timing of the last firmware upgrade */
+static SimpleSD_StatisticsTypeDef SimpleSD_Statistics;
+
+/* Flash geometry of the target MCU, sorted by address */
+static const SimpleSD_SectorTypeDef SimpleSD_FlashGeometry[] =
+{
+	SIMPLESD_FLASH_GEOMETRY
+};
+
+#define SIMPLESD_FLASH_SECTORS (sizeof(SimpleSD_FlashGeometry) / sizeof(SimpleSD_FlashGeometry[0]))
+
 static int16_t LED_Reload_Value;
 static int16_t LED_Toggle_Counter;
 
 typedef  void (*pFunction)(void);
 
+#if SIMPLESD_SKIP_IDENTICAL
+static uint8_t SimpleSD_ImageInstalled(uint32_t ImageSize);
+#endif
+static uint8_t SimpleSD_EraseSectors(uint32_t FirstSector, uint32_t LastSector);
+static uint32_t SimpleSD_SlotImageSize(uint32_t Base);
+static uint8_t SimpleSD_SlotCRC_Check(uint32_t Base);
+#if SIMPLESD_DUAL_BANK
+static uint32_t SimpleSD_SlotSequence(uint32_t Base);
+static uint8_t SimpleSD_SequenceNewer(uint32_t Sequence, uint32_t Other);
+static uint32_t SimpleSD_SequenceNext(uint32_t Sequence);
+static void SimpleSD_JumpBankSwap(uint32_t StackPointer, uint32_t ResetHandler);
+#endif
+static uint8_t SimpleSD_UpgradeAbort(uint8_t ErrorCode);
+static uint8_t SimpleSD_UpgradeFinish(uint32_t EndAddress);
+static FRESULT SimpleSD_ImageOpen(void);
+static FRESULT SimpleSD_StreamRead(void *Data, UINT Length, UINT *Bytes);
+static FRESULT SimpleSD_StreamSeek(uint32_t Offset);
+static uint32_t SimpleSD_StreamSize(void);
+static FRESULT SimpleSD_ImageRead(void *Data, UINT Length, UINT *Bytes);
+static FRESULT SimpleSD_ImageSeek(uint32_t Offset);
+static uint32_t SimpleSD_ImageFileSize(void);
+#if SIMPLESD_DELTA
+static uint8_t SimpleSD_DeltaOpen(void);
+static FRESULT SimpleSD_DeltaRestart(void);
+static FRESULT SimpleSD_DeltaControl(void);
+static FRESULT SimpleSD_DeltaRead(void *Data, UINT Length, UINT *Bytes);
+static FRESULT SimpleSD_DeltaSeek(uint32_t Offset);
+#endif
+#if SIMPLESD_LZ4
+static FRESULT SimpleSD_LZ4_Load(uint32_t Block, uint8_t *Data, uint32_t Size);
+static uint32_t SimpleSD_LZ4_Decode(const uint8_t *Source, uint32_t SourceSize, uint8_t *Data, uint32_t Size);
+#endif
+static uint8_t SimpleSD_ProgramRange(uint32_t Address, uint32_t EndAddress, uint32_t *ImageCRC);
+static uint8_t SimpleSD_CRC_Block(uint32_t Address, const uint32_t *Data, uint32_t Words, uint32_t *ImageCRC);
+static uint8_t SimpleSD_EraseAhead(uint32_t Address, uint32_t EndAddress);
+#if SIMPLESD_DIFFERENTIAL
+static uint8_t SimpleSD_CompareRange(uint32_t Address, uint32_t EndAddress, uint32_t *ImageCRC, uint8_t *Changed);
+#endif
+static uint32_t SimpleSD_SectorEnd(uint32_t Address);
+#if SIMPLESD_DIFFERENTIAL || SIMPLESD_BLOCK_CRC || SIMPLESD_JOURNAL
+static uint32_t SimpleSD_RangeEnd(uint32_t Address, uint32_t EndAddress);
+#endif
+#if SIMPLESD_JOURNAL
+static uint8_t SimpleSD_JournalResume(uint32_t ImageSize, uint32_t *Resume);
+static void SimpleSD_JournalBegin(uint32_t Resume);
+static void SimpleSD_JournalWrite(uint32_t Record);
+static void SimpleSD_JournalProgress(uint32_t Address);
+#endif
+#if SIMPLESD_BLOCK_CRC
+static uint8_t SimpleSD_ProgramChecked(uint32_t Address, uint32_t EndAddress, uint32_t *ImageCRC);
+static uint8_t SimpleSD_BlocksCheck(uint32_t Address, uint32_t EndAddress);
+static uint32_t SimpleSD_BlockCount(const uint32_t *Header, uint32_t ImageSize);
+static uint8_t SimpleSD_BlockCheck(uint32_t Base, uint32_t TableOffset, const uint32_t *Table, uint32_t Block);
+#endif
+#if SIMPLESD_BLANK_CHECK
+static uint8_t SimpleSD_SectorBlank(uint32_t Sector);
+#endif
+static void SimpleSD_FlashCacheReset(void);
+#if SIMPLESD_ERASE_OVERLAP
+static void SimpleSD_EraseStart(uint32_t Sector);
+static void SimpleSD_PrefetchReset(uint32_t Address, uint32_t EndAddress);
+static uint8_t SimpleSD_Prefetch(void);
+#endif
+static void SimpleSD_ProgramStart(uint32_t Address, const uint32_t *Data, uint32_t Words);
+static uint8_t SimpleSD_ProgramWait(void);
+static uint8_t SimpleSD_VerifyBlock(uint32_t Address, const uint32_t *Data, uint32_t Words);
+#if SIMPLESD_PIPELINE_ENABLED || (SIMPLESD_PROGRAM_ENGINE == SIMPLESD_PROGRAM_USING_HAL)
+static uint32_t SimpleSD_SkipErasedWords(void);
+#endif
+#if SIMPLESD_PIPELINE_ENABLED
+static void SimpleSD_ProgramNext(void);
+#endif
+static uint8_t SimpleSD_ProgramBlock(uint32_t Address, const uint32_t *Data, uint32_t Words);
+#if CRC_CALCULATION_METHOD
+static void SimpleSD_CRC_Seed(uint32_t Crc);
+static HAL_StatusTypeDef SimpleSD_CRC_DMA(const uint32_t *Data, uint32_t Words, uint32_t *Crc);
+#endif
+#if SIMPLESD_FAST_BOOT || SIMPLESD_VERIFIED_STAMP || SIMPLESD_JOURNAL
+static void SimpleSD_WriteBackup(uint32_t Index, uint32_t Value);
+#endif
+#if SIMPLESD_FAST_BOOT
+static uint32_t SimpleSD_BootTime(void);
+#endif
+#if SIMPLESD_VERIFIED_STAMP
+static uint32_t SimpleSD_StampValue(uint32_t Base);
+static void SimpleSD_StampWrite(void);
+static void SimpleSD_StampInvalidate(void);
+#endif
+static void SimpleSD_TimerStart(void);
+static uint32_t SimpleSD_TimeStamp(void);
+static uint32_t SimpleSD_ElapsedTime(uint32_t Start);
+
 /*
  * @brief  Firmware upgrade from SD
  * @param  None
@@ -46,14 +289,33 @@ typedef  void (*pFunction)(void);
 *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error
 *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error
 *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error
+*					- SIMPLESD_IMAGE_SIZE_ERROR:		  Firmware file does not fit the application area
+*					- SIMPLESD_IMAGE_CRC_ERROR:			  CRC of the firmware file is wrong
+*					- SIMPLESD_VERIFY_ERROR:			  Verification after the upgrade failed
+*					- SIMPLESD_FIRMWARE_UP_TO_DATE:		  Installed firmware is the same as the file
+*					- SIMPLESD_DELTA_BASE_ERROR:		  Patch for another firmware and no full image
 */
 
 uint8_t SimpleSD_FirmwareUpgrade(void)
 {
 	  UINT Bytes;
-	  uint32_t FileData;
-	  uint32_t firstSector, max_sectors, Address, sectorError;
-	  FLASH_EraseInitTypeDef EraseStruct;
+	  uint8_t status;
+	  uint32_t StartTime, UpgradeStartTime;
+	  uint32_t ImageSize, ImageCRC, EndAddress, Resume;
+#if SIMPLESD_DIFFERENTIAL
+	  uint8_t Changed;
+#endif
+#if SIMPLESD_DIFFERENTIAL || SIMPLESD_BLOCK_CRC || SIMPLESD_JOURNAL
+	  uint32_t Address, SectorEnd;
+#endif
+
+	  memset(&SimpleSD_Statistics, 0, sizeof(SimpleSD_Statistics));
+#if SIMPLESD_ERASE_OVERLAP
+	  /* Nothing is read ahead yet, the prefetch buffer may still hold data of an aborted upgrade */
+	  SimpleSD_PrefetchReset(0, 0);
+#endif
+	  SimpleSD_TimerStart();
+	  UpgradeStartTime = SimpleSD_TimeStamp();
 
 	  /* Turn off LED */
 	  SimpleSD_ModeLED(SIMPLESD_LED_STOPPED_MODE);
@@ -77,6 +339,23 @@ uint8_t SimpleSD_FirmwareUpgrade(void)
 			  return SIMPLESD_FS_OPEN_ERROR;
 		  }
 
+		  /* A compressed file is decompressed while it is read */
+		  fresult = SimpleSD_ImageOpen();
+		  if(fresult != FR_OK) {
+			  SimpleSD_DeInit();
+			  return SIMPLESD_FS_READ_ERROR;
+		  }
+
+#if SIMPLESD_DELTA
+		  /* A patch is applied to the installed firmware while it is read, a patch for another
+		   * firmware falls back to the full image */
+		  status = SimpleSD_DeltaOpen();
+		  if(status != SIMPLESD_OK) {
+			  SimpleSD_DeInit();
+			  return status;
+		  }
+#endif
+
 		  /* Toggle LED with 4Hz frequency*/
 		  SimpleSD_ModeLED(SIMPLESD_LED_4HZ_MODE);
 
@@ -84,34 +363,106 @@ uint8_t SimpleSD_FirmwareUpgrade(void)
 		  HAL_IWDG_Refresh(&hiwdg);
 #endif
 
+		  /* Find the area the image covers. A SimpleSD image declares its size in the vector table and
+		   * is followed by its CRC, a legacy image fills the whole application area */
+		  fresult = SimpleSD_ImageRead(SimpleSD_ReadBuffer[0], SIMPLESD_IMAGE_HEADER_SIZE, &Bytes);
+		  if((fresult != FR_OK) || (Bytes != SIMPLESD_IMAGE_HEADER_SIZE) || (SimpleSD_ImageSeek(0) != FR_OK)) {
+			  SimpleSD_DeInit();
+			  return SIMPLESD_FS_READ_ERROR;
+		  }
+		  ImageSize = SimpleSD_ImageSizeFromHeader(SimpleSD_ReadBuffer[0]);
+		  if(ImageSize == 0) {
+			  ImageSize = APPLICATION_CRC_CALCULATION_SIZE * 4;
+		  }
+		  if((SimpleSD_ImageFileSize() != (ImageSize + APPLICATION_CRC_SIZE)) ||
+			 (ImageSize + APPLICATION_CRC_SIZE + SIMPLESD_SLOT_RECORD_SIZE > APPLICATION_MAX_SIZE)) {
+			  SimpleSD_DeInit();
+			  return SIMPLESD_IMAGE_SIZE_ERROR;
+		  }
+
+#if SIMPLESD_DUAL_BANK
+		  /* Install to the inactive slot, the active one stays bootable */
+		  Image_Base = (SimpleSD_ActiveSlot() == SIMPLESD_SLOT_A_ADDRESS) ? SIMPLESD_SLOT_B_ADDRESS : SIMPLESD_SLOT_A_ADDRESS;
+#else
+		  Image_Base = APPLICATION_START_ADDRESS;
+#endif
+		  EndAddress = Image_Base + ImageSize + APPLICATION_CRC_SIZE;
+
+#if SIMPLESD_SKIP_IDENTICAL
+		  /* Leave the flash untouched if the file is already installed */
+		  status = SimpleSD_ImageInstalled(ImageSize);
+		  if(status != SIMPLESD_OK) {
+			  SimpleSD_DeInit();
+			  SimpleSD_Statistics.TotalTime = SimpleSD_ElapsedTime(UpgradeStartTime);
+			  /* Installed firmware is up to date or FS Read error */
+			  return status;
+		  }
+#endif
+
+#if SIMPLESD_BLOCK_CRC
+		  /* Read the block CRC table, the sectors are checked against it once programmed */
+		  Block_Count = SimpleSD_BlockCount(SimpleSD_ReadBuffer[0], ImageSize);
+		  Block_TableOffset = SimpleSD_ReadBuffer[0][SIMPLESD_IMAGE_BLOCKS_OFFSET / 4];
+		  if((Block_Count != 0) &&
+			 ((SimpleSD_ImageSeek(Block_TableOffset) != FR_OK) ||
+			  (SimpleSD_ImageRead(Block_CRC, Block_Count * sizeof(uint32_t), &Bytes) != FR_OK) ||
+			  (Bytes != Block_Count * sizeof(uint32_t)) || (SimpleSD_ImageSeek(0) != FR_OK))) {
+			  SimpleSD_DeInit();
+			  return SIMPLESD_FS_READ_ERROR;
+		  }
+#endif
+
+		  Image_CRCAddress = Image_Base + ImageSize;
+#if SIMPLESD_JOURNAL
+		  /* Resume an interrupted upgrade of the same file at the first sector not completed */
+		  status = SimpleSD_JournalResume(ImageSize, &Resume);
+		  if(status != SIMPLESD_OK) {
+			  SimpleSD_DeInit();
+			  return status;
+		  }
+#else
+		  Resume = Image_Base;
+#endif
+
+#if SIMPLESD_VERIFIED_STAMP
+		  /* The flash is about to change, the stamp of the installed firmware no longer holds */
+		  SimpleSD_StampInvalidate();
+#endif
+#if SIMPLESD_JOURNAL
+		  SimpleSD_JournalBegin(Resume);
+#endif
+
 		  /* Unlock the Flash to enable the flash control register access *************/
 		  HAL_FLASH_Unlock();
 
 		  /* Clear Flash error flags flag */
 		  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR | FLASH_FLAG_BSY);
 
-		  /* Get the 1st sector to erase */
-		  firstSector = SimpleSD_FindSector(APPLICATION_START_ADDRESS);
-
-		  /* Get the number of sectors to erase from 1st sector*/
-		  max_sectors = SimpleSD_FindSector(APPLICATION_END_ADDRESS) - firstSector + 1;
-
-		  /* Fill EraseInit structure First Half*/
-		  EraseStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
-		  EraseStruct.VoltageRange = FLASH_VOLTAGE_RANGE_3;
-		  EraseStruct.NbSectors = 1;
-
-		  for(uint32_t current_sector = firstSector; current_sector < (firstSector + max_sectors); current_sector++) {
-			  EraseStruct.Sector = current_sector;
-			  if(HAL_FLASHEx_Erase(&EraseStruct, &sectorError) != HAL_OK) {
-				  /* De-initialization of SD-FileSystem */
-				  SimpleSD_DeInit();
-				  /* Locks the FLASH control register access. */
-				  HAL_FLASH_Lock();
-				  /* Flash Erase error */
-				  return SIMPLESD_FLASH_ERASE_ERROR;
-			  }
+#if SIMPLESD_PIPELINE_ENABLED
+		  /* Flash programming and erasing are driven by the end of operation interrupt */
+		  HAL_NVIC_SetPriority(FLASH_IRQn, SIMPLESD_FLASH_IRQ_PRIORITY, 0);
+		  HAL_NVIC_EnableIRQ(FLASH_IRQn);
+#endif
+		  Program_Status = SIMPLESD_OK;
+
+#if !SIMPLESD_DIFFERENTIAL && (SIMPLESD_ERASE_POLICY == SIMPLESD_ERASE_UPFRONT)
+#if SIMPLESD_ERASE_OVERLAP
+		  /* The start of the file is read while the sectors are erased */
+		  SimpleSD_PrefetchReset(Resume, EndAddress);
+#endif
+		  /* Erase only the sectors covered by the image and its CRC */
+		  StartTime = SimpleSD_TimeStamp();
+		  status = SimpleSD_EraseSectors(SimpleSD_FindSector(Resume), SimpleSD_FindSector(EndAddress + SIMPLESD_SLOT_RECORD_SIZE - 1));
+		  SimpleSD_Statistics.EraseTime = SimpleSD_ElapsedTime(StartTime);
+		  if(status != SIMPLESD_OK) {
+			  /* Flash Erase error */
+			  return SimpleSD_UpgradeAbort(status);
 		  }
+		  Erase_Next = EndAddress + SIMPLESD_SLOT_RECORD_SIZE;
+#else
+		  /* Sectors are erased when the programming reaches them */
+		  Erase_Next = Resume;
+#endif
 
 		  /* Clear Flash error flags flag */
 		  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR | FLASH_FLAG_BSY);
@@ -121,22 +472,7 @@ uint8_t SimpleSD_FirmwareUpgrade(void)
 		  HAL_IWDG_Refresh(&hiwdg);
 #endif
 
-#if SD_WATCHDOG_RUNNING
-		  HAL_IWDG_Refresh(&hiwdg);
-#endif
-
-		  /* Disable the FLASH data cache */
-		  __HAL_FLASH_DATA_CACHE_DISABLE();
-		  /* Disable the FLASH instruction cache */
-		  __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
-		  /* Resets the FLASH data Cache. */
-		  __HAL_FLASH_DATA_CACHE_RESET();
-		  /* Resets the FLASH instruction Cache. */
-		  __HAL_FLASH_INSTRUCTION_CACHE_RESET();
-		  /* Enable the FLASH instruction cache */
-		  __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
-		  /* Enable the FLASH data cache. */
-		  __HAL_FLASH_DATA_CACHE_ENABLE();
+		  SimpleSD_FlashCacheReset();
 
 #if SD_WATCHDOG_RUNNING
 		  HAL_IWDG_Refresh(&hiwdg);
@@ -149,136 +485,1886 @@ uint8_t SimpleSD_FirmwareUpgrade(void)
 		  __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR | FLASH_FLAG_BSY);
 
 
-		  Address = APPLICATION_START_ADDRESS;
-		  while (Address < APPLICATION_END_ADDRESS)
+		  /* The CRC of the part programmed before an interruption is calculated from the flash, the
+		   * CRC of the file checks it together with the rest */
+		  StartTime = SimpleSD_TimeStamp();
+		  ImageCRC = SimpleSD_CRC_Update(0xFFFFFFFF, (const uint32_t *)Image_Base, (Resume - Image_Base) / sizeof(uint32_t));
+		  SimpleSD_Statistics.CRCTime += SimpleSD_ElapsedTime(StartTime);
+		  SimpleSD_Statistics.ResumedBytes = Resume - Image_Base;
+
+#if SIMPLESD_DIFFERENTIAL
+		  /* Compare every sector with the file and rewrite only the sectors that differ */
+		  Address = Resume;
+		  while (Address < EndAddress)
 		  {
-			fresult = f_read(&SimpleSD_file, &FileData, sizeof(FileData), &Bytes);
-			if((Bytes == 0) || (fresult != FR_OK)) {
-				/* De-initialization of SD-FileSystem */
-				SimpleSD_DeInit();
-				/* Locks the FLASH control register access. */
-				HAL_FLASH_Lock();
-				/* FS Read error */
-				return SIMPLESD_FS_READ_ERROR;
-			}
+			  SectorEnd = SimpleSD_RangeEnd(Address, EndAddress);
 
-			if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, Address, FileData) == HAL_OK)	{
-			  if(*(uint32_t*)Address != FileData) {
-				 /* De-initialization of SD-FileSystem */
-				 SimpleSD_DeInit();
-				 /* Locks the FLASH control register access. */
-				 HAL_FLASH_Lock();
-				 /* Flash Data Compare error */
-			     return SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+			  /* The CRC of the image is calculated on the compare pass */
+			  status = SimpleSD_CompareRange(Address, SectorEnd, &ImageCRC, &Changed);
+			  if(status != SIMPLESD_OK) {
+				  return SimpleSD_UpgradeAbort(status);
 			  }
-			  Address += sizeof(FileData);
-			}
-			else {
-				/* De-initialization of SD-FileSystem */
-				SimpleSD_DeInit();
-				/* Locks the FLASH control register access. */
-				HAL_FLASH_Lock();
-				/* Flash Write error */
-				return SIMPLESD_FLASH_WRITE_ERROR;
-			}
+
+			  if(Changed) {
+				  /* Read the sector again from the file and program it, the sector is erased
+				   * when the programming reaches it */
+				  if(SimpleSD_ImageSeek(Address - Image_Base) != FR_OK) {
+					  /* FS Read error */
+					  return SimpleSD_UpgradeAbort(SIMPLESD_FS_READ_ERROR);
+				  }
+				  Erase_Next = Address;
+#if SIMPLESD_BLOCK_CRC
+				  status = SimpleSD_ProgramChecked(Address, SectorEnd, NULL);
+#else
+				  status = SimpleSD_ProgramRange(Address, SectorEnd, NULL);
+#endif
+				  if(status != SIMPLESD_OK) {
+					  return SimpleSD_UpgradeAbort(status);
+				  }
+				  SimpleSD_Statistics.RewrittenSectors++;
+			  }
+			  else {
+				  SimpleSD_Statistics.SkippedSectors++;
+			  }
+#if SIMPLESD_JOURNAL
+			  SimpleSD_JournalProgress(SectorEnd);
+#endif
+			  Address = SectorEnd;
+		  }
+#else
+#if SIMPLESD_BLOCK_CRC || SIMPLESD_JOURNAL
+		  /* Stream the file sector by sector. Every sector is checked with the block CRC table once
+		   * programmed and recorded in the journal */
+		  Address = Resume;
+		  while (Address < EndAddress)
+		  {
+			  SectorEnd = SimpleSD_RangeEnd(Address, EndAddress);
+#if SIMPLESD_BLOCK_CRC
+			  status = SimpleSD_ProgramChecked(Address, SectorEnd, &ImageCRC);
+#else
+			  status = SimpleSD_ProgramRange(Address, SectorEnd, &ImageCRC);
+#endif
+			  if(status != SIMPLESD_OK) {
+				  return SimpleSD_UpgradeAbort(status);
+			  }
+#if SIMPLESD_JOURNAL
+			  SimpleSD_JournalProgress(SectorEnd);
+#endif
+			  Address = SectorEnd;
+		  }
+#else
+		  /* Stream the whole file to the erased flash */
+		  status = SimpleSD_ProgramRange(Image_Base, EndAddress, &ImageCRC);
+		  if(status != SIMPLESD_OK) {
+			  return SimpleSD_UpgradeAbort(status);
+		  }
+#endif
+#endif
+		  status = SimpleSD_UpgradeFinish(EndAddress);
+		  if(status != SIMPLESD_OK) {
+			  return SimpleSD_UpgradeAbort(status);
 		  }
+
 		  /* De-initialization of SD-FileSystem */
 		  SimpleSD_DeInit();
 		  /* Locks the FLASH control register access. */
 		  HAL_FLASH_Lock();
-		  /* Success */
-		  if(SimpleSD_CRC_Check() == SIMPLESD_CRC_SAME) {
-			  return SIMPLESD_OK;
+
+		  /* Every block has been compared once programmed and the CRC has been checked on the
+		   * streamed data, the flash is only read again if requested */
+		  StartTime = SimpleSD_TimeStamp();
+		  status = SIMPLESD_OK;
+#if SIMPLESD_POST_VERIFY == SIMPLESD_VERIFY_SPOT
+		  if((SimpleSD_SlotImageSize(Image_Base) != ImageSize) || (*(uint32_t*)(Image_Base + ImageSize) != ImageCRC)) {
+			  status = SIMPLESD_VERIFY_ERROR;
 		  }
+#elif SIMPLESD_POST_VERIFY == SIMPLESD_VERIFY_FULL
+		  if(SimpleSD_SlotCRC_Check(Image_Base) != SIMPLESD_CRC_SAME) {
+			  status = SIMPLESD_VERIFY_ERROR;
+		  }
+#endif
+		  SimpleSD_Statistics.VerifyTime = SimpleSD_ElapsedTime(StartTime);
+#if SIMPLESD_VERIFIED_STAMP
+		  if(status == SIMPLESD_OK) {
+			  /* The CRC has been checked on the streamed data, the next boot needs no CRC calculation */
+			  SimpleSD_StampWrite();
+		  }
+#endif
+		  SimpleSD_Statistics.TotalTime = SimpleSD_ElapsedTime(UpgradeStartTime);
+		  return status;
 	  }
 	  /* No SD detected */
 	  return SIMPLESD_NO_SD;
 }
 
+#if SIMPLESD_SKIP_IDENTICAL
 /*
- * @brief  Finds the desired Flash sector based on the input address
- * @param  Address: The desired address on flash
- * 					- APPLICATION_START_ADDRESS to APPLICATION_END_ADDRESS: Any address on the area of main application
- * @retval sector:
- * 					- 0 to 23: The flash sector
+ * @brief  Checks if the opened firmware file is already installed. The header of the file
+ *         [vector table with size and version] must be in SimpleSD_ReadBuffer[0]
+ * @param  ImageSize: Size of the image of the file without its CRC
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  The file must be programmed
+ *					- SIMPLESD_FIRMWARE_UP_TO_DATE:		  The file is installed and its CRC is correct
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
  */
-uint32_t SimpleSD_FindSector(uint32_t Address)
+static uint8_t SimpleSD_ImageInstalled(uint32_t ImageSize)
 {
-  uint32_t sector = 0;
+	UINT Bytes;
+	uint32_t FileCRC, Base = SimpleSD_ActiveSlot();
 
-  if((Address < ADDR_FLASH_SECTOR_1) && (Address >= ADDR_FLASH_SECTOR_0)) {
-    sector = FLASH_SECTOR_0;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_2) && (Address >= ADDR_FLASH_SECTOR_1)) {
-    sector = FLASH_SECTOR_1;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_3) && (Address >= ADDR_FLASH_SECTOR_2)) {
-    sector = FLASH_SECTOR_2;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_4) && (Address >= ADDR_FLASH_SECTOR_3)) {
-    sector = FLASH_SECTOR_3;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_5) && (Address >= ADDR_FLASH_SECTOR_4)) {
-    sector = FLASH_SECTOR_4;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_6) && (Address >= ADDR_FLASH_SECTOR_5)) {
-    sector = FLASH_SECTOR_5;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_7) && (Address >= ADDR_FLASH_SECTOR_6)) {
-    sector = FLASH_SECTOR_6;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_8) && (Address >= ADDR_FLASH_SECTOR_7)) {
-    sector = FLASH_SECTOR_7;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_9) && (Address >= ADDR_FLASH_SECTOR_8)) {
-    sector = FLASH_SECTOR_8;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_10) && (Address >= ADDR_FLASH_SECTOR_9)) {
-    sector = FLASH_SECTOR_9;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_11) && (Address >= ADDR_FLASH_SECTOR_10)) {
-    sector = FLASH_SECTOR_10;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_12) && (Address >= ADDR_FLASH_SECTOR_11)) {
-    sector = FLASH_SECTOR_11;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_13) && (Address >= ADDR_FLASH_SECTOR_12)) {
-    sector = FLASH_SECTOR_12;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_14) && (Address >= ADDR_FLASH_SECTOR_13)) {
-    sector = FLASH_SECTOR_13;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_15) && (Address >= ADDR_FLASH_SECTOR_14)) {
-    sector = FLASH_SECTOR_14;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_16) && (Address >= ADDR_FLASH_SECTOR_15)) {
-    sector = FLASH_SECTOR_15;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_17) && (Address >= ADDR_FLASH_SECTOR_16)) {
-    sector = FLASH_SECTOR_16;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_18) && (Address >= ADDR_FLASH_SECTOR_17)) {
-    sector = FLASH_SECTOR_17;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_19) && (Address >= ADDR_FLASH_SECTOR_18)) {
-    sector = FLASH_SECTOR_18;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_20) && (Address >= ADDR_FLASH_SECTOR_19)) {
-    sector = FLASH_SECTOR_19;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_21) && (Address >= ADDR_FLASH_SECTOR_20)) {
-    sector = FLASH_SECTOR_20;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_22) && (Address >= ADDR_FLASH_SECTOR_21)) {
-    sector = FLASH_SECTOR_21;
-  }
-  else if((Address < ADDR_FLASH_SECTOR_23) && (Address >= ADDR_FLASH_SECTOR_22)) {
-    sector = FLASH_SECTOR_22;
+	/* Cheap checks first: size, header and CRC word */
+	if((SimpleSD_SlotImageSize(Base) != ImageSize) ||
+	   (memcmp(SimpleSD_ReadBuffer[0], (const void *)Base, SIMPLESD_IMAGE_HEADER_SIZE) != 0)) {
+		return SIMPLESD_OK;
+	}
+	if((SimpleSD_ImageSeek(ImageSize) != FR_OK) ||
+	   (SimpleSD_ImageRead(&FileCRC, sizeof(FileCRC), &Bytes) != FR_OK) || (Bytes != sizeof(FileCRC)) ||
+	   (SimpleSD_ImageSeek(0) != FR_OK)) {
+		/* FS Read error */
+		return SIMPLESD_FS_READ_ERROR;
+	}
+	if(FileCRC != *(uint32_t*)(Base + ImageSize)) {
+		return SIMPLESD_OK;
+	}
+
+	/* Same image, reprogram it only if the installed copy is damaged */
+	if(SimpleSD_SlotCRC_Check(Base) != SIMPLESD_CRC_SAME) {
+		return SIMPLESD_OK;
+	}
+	return SIMPLESD_FIRMWARE_UP_TO_DATE;
+}
+#endif
+
+/*
+ * @brief  Reads a range of the firmware file and programs it to the erased flash, the next
+ *         block is read while the previous one is programmed
+ * @param  Address: Flash address of the range, the file must be positioned at the same offset
+ * 		   EndAddress: End of the range [excluded]
+ * 		   ImageCRC: CRC of the image so far, updated with the range. NULL if the CRC of the
+ * 		   			 range has already been calculated
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error
+ *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error
+ *					- SIMPLESD_IMAGE_CRC_ERROR:			  CRC of the firmware file is wrong
+ */
+static uint8_t SimpleSD_ProgramRange(uint32_t Address, uint32_t EndAddress, uint32_t *ImageCRC)
+{
+	UINT Bytes;
+	uint8_t status, next;
+	uint32_t Words, Length, StartTime;
+	const uint32_t *Data;
+	static uint8_t buffer;
+
+	while (Address < EndAddress)
+	{
+		/* Erase the sector the programming has reached, the block ends with the erased flash */
+		status = SimpleSD_EraseAhead(Address, EndAddress);
+		if(status != SIMPLESD_OK) {
+			return status;
+		}
+		Length = ((EndAddress < Erase_Next) ? EndAddress : Erase_Next) - Address;
+		next = buffer;
+#if SIMPLESD_ERASE_OVERLAP
+		if((Address >= Prefetch_Start) && (Address < Prefetch_End)) {
+			/* Program the part of the file read ahead during the erase */
+			if(Length > Prefetch_End - Address) {
+				Length = Prefetch_End - Address;
+			}
+			Data = &SimpleSD_PrefetchBuffer[(Address - Prefetch_Start) / sizeof(uint32_t)];
+		}
+		else
+#endif
+		{
+			/* Read the next block of the file, while the previous one is being programmed.
+			 * Full sectors are transferred by FatFs directly into the buffer */
+			if(Length > SIMPLESD_READ_BUFFER_SIZE) {
+				Length = SIMPLESD_READ_BUFFER_SIZE;
+			}
+			StartTime = SimpleSD_TimeStamp();
+			fresult = SimpleSD_ImageRead(SimpleSD_ReadBuffer[buffer], Length, &Bytes);
+			SimpleSD_Statistics.ReadTime += SimpleSD_ElapsedTime(StartTime);
+			if((Bytes != Length) || (fresult != FR_OK)) {
+				/* FS Read error */
+				return SIMPLESD_FS_READ_ERROR;
+			}
+			SimpleSD_Statistics.BytesRead += Bytes;
+			Data = SimpleSD_ReadBuffer[buffer];
+			next = (buffer + 1) % SIMPLESD_READ_BUFFERS;
+		}
+
+		/* The size of the file has been checked, ranges are whole words */
+		Words = Length / sizeof(uint32_t);
+
+		/* Accumulate the CRC of the image on the block, while the previous one is being programmed */
+		if(ImageCRC != NULL) {
+			status = SimpleSD_CRC_Block(Address, Data, Words, ImageCRC);
+			if(status != SIMPLESD_OK) {
+				/* Image CRC error */
+				return status;
+			}
+		}
+
+#if SD_WATCHDOG_RUNNING
+		HAL_IWDG_Refresh(&hiwdg);
+#endif
+
+		/* Wait until the previous block has been programmed */
+		StartTime = SimpleSD_TimeStamp();
+		status = SimpleSD_ProgramWait();
+		SimpleSD_Statistics.WaitTime += SimpleSD_ElapsedTime(StartTime);
+		if(status != SIMPLESD_OK) {
+			/* Flash Write or Flash Data Compare error */
+			return status;
+		}
+
+		SimpleSD_ProgramStart(Address, Data, Words);
+		Address += Words * sizeof(uint32_t);
+		buffer = next;
+	}
+
+	/* Wait until the last block has been programmed */
+	StartTime = SimpleSD_TimeStamp();
+	status = SimpleSD_ProgramWait();
+	SimpleSD_Statistics.WaitTime += SimpleSD_ElapsedTime(StartTime);
+	return status;
+}
+
+/*
+ * @brief  Accumulates the CRC of the image on a block of the file. If the block holds the CRC
+ *         of the file, it is compared before it gets programmed, so a wrong image is never
+ *         marked as valid
+ * @param  Address: Flash address of the block
+ * 		   Data: The words of the block
+ * 		   Words: Number of words in the block
+ * 		   ImageCRC: CRC of the image so far, updated with the block
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_IMAGE_CRC_ERROR:			  CRC of the firmware file is wrong
+ */
+static uint8_t SimpleSD_CRC_Block(uint32_t Address, const uint32_t *Data, uint32_t Words, uint32_t *ImageCRC)
+{
+	uint32_t CRCWords, StartTime;
+
+	StartTime = SimpleSD_TimeStamp();
+	CRCWords = (Image_CRCAddress - Address) / sizeof(uint32_t);
+	if(CRCWords > Words) {
+		CRCWords = Words;
+	}
+	*ImageCRC = SimpleSD_CRC_Update(*ImageCRC, Data, CRCWords);
+	SimpleSD_Statistics.CRCTime += SimpleSD_ElapsedTime(StartTime);
+
+	if((CRCWords < Words) && (Data[CRCWords] != *ImageCRC)) {
+		/* Image CRC error */
+		return SIMPLESD_IMAGE_CRC_ERROR;
+	}
+	return SIMPLESD_OK;
+}
+
+#if SIMPLESD_DIFFERENTIAL
+/*
+ * @brief  Compares a range of the firmware file with the flash and calculates its CRC
+ * @param  Address: Flash address of the range, the file must be positioned at the same offset
+ * 		   EndAddress: End of the range [excluded]
+ * 		   ImageCRC: CRC of the image so far, updated with the range
+ * 		   Changed: Set to 1 if the file and the flash differ, else 0
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
+ *					- SIMPLESD_IMAGE_CRC_ERROR:			  CRC of the firmware file is wrong
+ */
+static uint8_t SimpleSD_CompareRange(uint32_t Address, uint32_t EndAddress, uint32_t *ImageCRC, uint8_t *Changed)
+{
+	UINT Bytes;
+	uint8_t status;
+	uint32_t Length, StartTime;
+
+	*Changed = 0;
+	while (Address < EndAddress)
+	{
+		Length = EndAddress - Address;
+		if(Length > SIMPLESD_READ_BUFFER_SIZE) {
+			Length = SIMPLESD_READ_BUFFER_SIZE;
+		}
+		StartTime = SimpleSD_TimeStamp();
+		fresult = SimpleSD_ImageRead(SimpleSD_ReadBuffer[0], Length, &Bytes);
+		SimpleSD_Statistics.ReadTime += SimpleSD_ElapsedTime(StartTime);
+		if((Bytes != Length) || (fresult != FR_OK)) {
+			/* FS Read error */
+			return SIMPLESD_FS_READ_ERROR;
+		}
+		SimpleSD_Statistics.BytesRead += Bytes;
+
+		status = SimpleSD_CRC_Block(Address, SimpleSD_ReadBuffer[0], Length / sizeof(uint32_t), ImageCRC);
+		if(status != SIMPLESD_OK) {
+			/* Image CRC error */
+			return status;
+		}
+
+		StartTime = SimpleSD_TimeStamp();
+		if(!*Changed && (memcmp(SimpleSD_ReadBuffer[0], (const void *)Address, Length) != 0)) {
+			*Changed = 1;
+		}
+		SimpleSD_Statistics.CompareTime += SimpleSD_ElapsedTime(StartTime);
+
+#if SD_WATCHDOG_RUNNING
+		HAL_IWDG_Refresh(&hiwdg);
+#endif
+		Address += Length;
+	}
+	return SIMPLESD_OK;
+}
+
+#endif
+
+/*
+ * @brief  Finds the end of the flash sector holding an address
+ * @param  Address: Any address in the application area
+ * @retval Address of the next sector
+ */
+static uint32_t SimpleSD_SectorEnd(uint32_t Address)
+{
+	const SimpleSD_SectorTypeDef *sector = &SimpleSD_FlashGeometry[SimpleSD_FindSector(Address)];
+
+	return sector->Base + sector->Size;
+}
+
+#if SIMPLESD_DIFFERENTIAL || SIMPLESD_BLOCK_CRC || SIMPLESD_JOURNAL
+/*
+ * @brief  Finds the end of the range of whole sectors starting at an address. With a block CRC table
+ *         the range is extended until it also holds whole blocks [sectors smaller than a block]
+ * @param  Address: Start of the range, the base of a sector
+ * 		   EndAddress: End of the image, the range ends there at the latest
+ * @retval End of the range [excluded]
+ */
+static uint32_t SimpleSD_RangeEnd(uint32_t Address, uint32_t EndAddress)
+{
+	uint32_t End = SimpleSD_SectorEnd(Address);
+
+#if SIMPLESD_BLOCK_CRC
+	while((Block_Count != 0) && (End < EndAddress) && ((End - Image_Base) % SIMPLESD_IMAGE_BLOCK_SIZE)) {
+		End = SimpleSD_SectorEnd(End);
+	}
+#endif
+	if(End > EndAddress) {
+		End = EndAddress;
+	}
+	return End;
+}
+#endif
+
+#if SIMPLESD_JOURNAL
+/*
+ * @brief  Finds where an interrupted upgrade of the opened file stopped. The file is positioned there
+ * @param  ImageSize: Size of the image of the file without its CRC
+ * 		   Resume: Set to the first address to program, Image_Base if nothing can be resumed
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
+ */
+static uint8_t SimpleSD_JournalResume(uint32_t ImageSize, uint32_t *Resume)
+{
+	UINT Bytes;
+	uint32_t Progress = SIMPLESD_JOURNAL_DONE;
+
+	/* The CRC word of the file identifies the image in the journal */
+	if((SimpleSD_ImageSeek(ImageSize) != FR_OK) ||
+	   (SimpleSD_ImageRead(&Journal_Image, sizeof(Journal_Image), &Bytes) != FR_OK) || (Bytes != sizeof(Journal_Image))) {
+		/* FS Read error */
+		return SIMPLESD_FS_READ_ERROR;
+	}
+
+	if(SIMPLESD_BKP_REGISTER(SIMPLESD_JOURNAL_IMAGE_BKP) == Journal_Image) {
+		Progress = SIMPLESD_BKP_REGISTER(SIMPLESD_JOURNAL_PROGRESS_BKP);
+	}
+	*Resume = ((Progress > Image_Base) && (Progress <= Image_CRCAddress)) ? Progress : Image_Base;
+	if(SimpleSD_ImageSeek(*Resume - Image_Base) != FR_OK) {
+		/* FS Read error */
+		return SIMPLESD_FS_READ_ERROR;
+	}
+	return SIMPLESD_OK;
+}
+
+/*
+ * @brief  Records the start of an upgrade. Unless an upgrade of the same image is resumed, the progress is
+ *         cleared before the image word is written, so a reset in between has nothing to resume
+ * @param  Resume: First address to program, found by SimpleSD_JournalResume()
+ * @retval None
+ */
+static void SimpleSD_JournalBegin(uint32_t Resume)
+{
+	if(Resume == Image_Base) {
+		SimpleSD_JournalWrite(SIMPLESD_JOURNAL_DONE);
+		SimpleSD_WriteBackup(SIMPLESD_JOURNAL_IMAGE_BKP, Journal_Image);
+	}
+}
+
+/*
+ * @brief  Records the progress of the image being installed
+ * @param  Record: SIMPLESD_JOURNAL_DONE or the address completed
+ * @retval None
+ */
+static void SimpleSD_JournalWrite(uint32_t Record)
+{
+	SimpleSD_WriteBackup(SIMPLESD_JOURNAL_PROGRESS_BKP, Record);
+}
+
+/*
+ * @brief  Records that the image is programmed and verified up to an address. The range holding the
+ *         CRC of the image is not recorded, the upgrade is over once it is programmed
+ * @param  Address: End of the range completed
+ * @retval None
+ */
+static void SimpleSD_JournalProgress(uint32_t Address)
+{
+	if(Address <= Image_CRCAddress) {
+		SimpleSD_JournalWrite(Address);
+	}
+}
+#endif
+
+#if SIMPLESD_BLOCK_CRC
+/*
+ * @brief  Programs a range of whole sectors and checks the blocks it holds with the block CRC table.
+ *         A range failing the check is erased and programmed again from the file, up to
+ *         SIMPLESD_SECTOR_RETRIES times
+ * @param  Address: Flash address of the range, the file must be positioned at the same offset
+ * 		   EndAddress: End of the range [excluded], see SimpleSD_RangeEnd()
+ * 		   ImageCRC: CRC of the image so far, updated with the range. NULL if the CRC of the
+ * 		   			 range has already been calculated
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
+ *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error
+ *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error, or block CRC error after the retries
+ *					- SIMPLESD_IMAGE_CRC_ERROR:			  CRC of the firmware file is wrong
+ */
+static uint8_t SimpleSD_ProgramChecked(uint32_t Address, uint32_t EndAddress, uint32_t *ImageCRC)
+{
+	uint8_t status;
+	uint32_t EraseNext, Retries = 0;
+
+	status = SimpleSD_ProgramRange(Address, EndAddress, ImageCRC);
+	while((status == SIMPLESD_OK) && (SimpleSD_BlocksCheck(Address, EndAddress) != SIMPLESD_CRC_SAME))
+	{
+		if(Retries++ == SIMPLESD_SECTOR_RETRIES) {
+			/* Flash Data Compare error */
+			return SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+		}
+		SimpleSD_Statistics.RetriedSectors++;
+
+		/* Read the range again from the file, the CRC of the image has already been calculated */
+		if(SimpleSD_ImageSeek(Address - Image_Base) != FR_OK) {
+			/* FS Read error */
+			return SIMPLESD_FS_READ_ERROR;
+		}
+#if SIMPLESD_ERASE_OVERLAP
+		SimpleSD_PrefetchReset(Address, Address);
+#endif
+		/* Erase the range again, sectors erased upfront after it stay erased */
+		EraseNext = Erase_Next;
+		Erase_Next = Address;
+		status = SimpleSD_ProgramRange(Address, EndAddress, NULL);
+		if(Erase_Next < EraseNext) {
+			Erase_Next = EraseNext;
+		}
+	}
+	return status;
+}
+
+/*
+ * @brief  Checks the blocks of the image being installed that start in a range
+ * @param  Address: Start of the range, the start of a block
+ * 		   EndAddress: End of the range [excluded]
+ * @retval enum SimpleSD_CRC:
+ * 					- SIMPLESD_CRC_SAME       		  All blocks match the block CRC table
+ *					- SIMPLESD_CRC_ERROR:	 		  A block does not match
+ */
+static uint8_t SimpleSD_BlocksCheck(uint32_t Address, uint32_t EndAddress)
+{
+	uint8_t result = SIMPLESD_CRC_SAME;
+	uint32_t Block, StartTime;
+
+	StartTime = SimpleSD_TimeStamp();
+	for(Block = (Address - Image_Base) / SIMPLESD_IMAGE_BLOCK_SIZE;
+		(Block < Block_Count) && (Image_Base + Block * SIMPLESD_IMAGE_BLOCK_SIZE < EndAddress) && (result == SIMPLESD_CRC_SAME);
+		Block++) {
+		result = SimpleSD_BlockCheck(Image_Base, Block_TableOffset, Block_CRC, Block);
+	}
+	SimpleSD_Statistics.BlockCRCTime += SimpleSD_ElapsedTime(StartTime);
+	return result;
+}
+
+/*
+ * @brief  Number of blocks in the block CRC table of a SimpleSD image. The table follows the blocks
+ *         at the end of the image, one CRC word per SIMPLESD_IMAGE_BLOCK_SIZE bytes
+ * @param  Header: The first SIMPLESD_IMAGE_HEADER_SIZE bytes of the image
+ * 		   ImageSize: Size of the image without its CRC
+ * @retval Number of blocks, 0 if the image has no valid block CRC table
+ */
+static uint32_t SimpleSD_BlockCount(const uint32_t *Header, uint32_t ImageSize)
+{
+	uint32_t count, offset = Header[SIMPLESD_IMAGE_BLOCKS_OFFSET / 4];
+
+	if((Header[SIMPLESD_IMAGE_MAGIC_OFFSET / 4] != SIMPLESD_IMAGE_MAGIC) || (offset == 0) ||
+	   (offset % sizeof(uint32_t)) || (offset > ImageSize)) {
+		return 0;
+	}
+	count = (offset + SIMPLESD_IMAGE_BLOCK_SIZE - 1) / SIMPLESD_IMAGE_BLOCK_SIZE;
+	if((count > SIMPLESD_IMAGE_MAX_BLOCKS) || (ImageSize - offset != count * sizeof(uint32_t))) {
+		return 0;
+	}
+	return count;
+}
+
+/*
+ * @brief  Checks one block of an image in flash with its block CRC table
+ * @param  Base: Flash address of the image
+ * 		   TableOffset: Offset of the block CRC table in the image, the blocks end there
+ * 		   Table: The block CRC table
+ * 		   Block: The block to check
+ * @retval enum SimpleSD_CRC:
+ * 					- SIMPLESD_CRC_SAME       		  The block matches its CRC
+ *					- SIMPLESD_CRC_ERROR:	 		  The block does not match its CRC
+ */
+static uint8_t SimpleSD_BlockCheck(uint32_t Base, uint32_t TableOffset, const uint32_t *Table, uint32_t Block)
+{
+	uint32_t Offset = Block * SIMPLESD_IMAGE_BLOCK_SIZE, Length = TableOffset - Offset;
+
+	if(Length > SIMPLESD_IMAGE_BLOCK_SIZE) {
+		Length = SIMPLESD_IMAGE_BLOCK_SIZE;
+	}
+	if(SimpleSD_CRC_Update(0xFFFFFFFF, (const uint32_t *)(Base + Offset), Length / sizeof(uint32_t)) != Table[Block]) {
+		return SIMPLESD_CRC_ERROR;
+	}
+	return SIMPLESD_CRC_SAME;
+}
+#endif
+
+/*
+ * @brief  Erase scheduler: erases the sector holding an address if the programming has reached
+ *         the part of the flash not erased yet [Erase_Next]. With SIMPLESD_ERASE_UPFRONT the whole
+ *         image has been erased before and nothing is done
+ * @param  Address: Flash address about to be programmed
+ * 		   EndAddress: End of the range being programmed, reading ahead stops there
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error of the block in progress
+ *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error of the block in progress
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error while reading ahead
+ */
+static uint8_t SimpleSD_EraseAhead(uint32_t Address, uint32_t EndAddress)
+{
+	uint8_t status;
+	uint32_t StartTime;
+
+	if(Address < Erase_Next) {
+		return SIMPLESD_OK;
+	}
+
+	/* The block in progress must be programmed before the erase starts */
+	StartTime = SimpleSD_TimeStamp();
+	status = SimpleSD_ProgramWait();
+	SimpleSD_Statistics.WaitTime += SimpleSD_ElapsedTime(StartTime);
+	if(status != SIMPLESD_OK) {
+		return status;
+	}
+
+#if SIMPLESD_ERASE_OVERLAP
+	/* Read ahead from the address unless the data is in the read-ahead buffer already */
+	if((Address < Prefetch_Start) || (Address >= Prefetch_End)) {
+		SimpleSD_PrefetchReset(Address, EndAddress);
+	}
+#else
+	(void)EndAddress;
+#endif
+	StartTime = SimpleSD_TimeStamp();
+	status = SimpleSD_EraseSectors(SimpleSD_FindSector(Address), SimpleSD_FindSector(Address));
+	SimpleSD_Statistics.EraseTime += SimpleSD_ElapsedTime(StartTime);
+	if(status != SIMPLESD_OK) {
+		/* Flash Erase error */
+		return status;
+	}
+	SimpleSD_FlashCacheReset();
+	Erase_Next = SimpleSD_SectorEnd(Address);
+	return SIMPLESD_OK;
+}
+
+/*
+ * @brief  Resets the FLASH instruction and data caches, so no content from before an erase is read back
+ * @param  None
+ * @retval None
+ */
+static void SimpleSD_FlashCacheReset(void)
+{
+	/* Disable the FLASH data cache */
+	__HAL_FLASH_DATA_CACHE_DISABLE();
+	/* Disable the FLASH instruction cache */
+	__HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+	/* Resets the FLASH data Cache. */
+	__HAL_FLASH_DATA_CACHE_RESET();
+	/* Resets the FLASH instruction Cache. */
+	__HAL_FLASH_INSTRUCTION_CACHE_RESET();
+	/* Enable the FLASH instruction cache */
+	__HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+	/* Enable the FLASH data cache. */
+	__HAL_FLASH_DATA_CACHE_ENABLE();
+}
+
+/*
+ * @brief  Erases a range of flash sectors, sectors found blank are skipped
+ * @param  FirstSector: First sector to erase
+ * 		   LastSector: Last sector to erase [included]
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error while reading ahead
+ */
+static uint8_t SimpleSD_EraseSectors(uint32_t FirstSector, uint32_t LastSector)
+{
+#if SIMPLESD_ERASE_OVERLAP
+	uint8_t status;
+#else
+	uint32_t sectorError;
+	FLASH_EraseInitTypeDef EraseStruct;
+
+	EraseStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+	EraseStruct.VoltageRange = SIMPLESD_VOLTAGE_RANGE;
+	EraseStruct.NbSectors = 1;
+#endif
+
+#if SIMPLESD_BLANK_CHECK
+	/* Read the flash itself, not what the data cache holds from before a programming */
+	SimpleSD_FlashCacheReset();
+#endif
+
+	for(uint32_t current_sector = FirstSector; current_sector <= LastSector; current_sector++) {
+#if SIMPLESD_BLANK_CHECK
+		if(SimpleSD_SectorBlank(current_sector)) {
+			SimpleSD_Statistics.BlankSectors++;
+			continue;
+		}
+#endif
+
+#if SIMPLESD_ERASE_OVERLAP
+		SimpleSD_EraseStart(current_sector);
+		/* Read ahead from the SD card until the sector is erased or the prefetch buffer is full. Only the
+		 * erase of a Bank 2 sector overlaps, the code runs from Bank 1 and every fetch stalls while a
+		 * Bank 1 sector is erased */
+		while((Program_Status == SIMPLESD_PROGRAM_BUSY) && (SimpleSD_FlashGeometry[current_sector].Bank != 1) &&
+			  (Prefetch_End < Prefetch_Limit) && (Prefetch_End - Prefetch_Start < SIMPLESD_PREFETCH_SIZE)) {
+			if(SimpleSD_Prefetch() != SIMPLESD_OK) {
+				SimpleSD_ProgramWait();
+				/* FS Read error */
+				return SIMPLESD_FS_READ_ERROR;
+			}
+#if SD_WATCHDOG_RUNNING
+			HAL_IWDG_Refresh(&hiwdg);
+#endif
+		}
+		status = SimpleSD_ProgramWait();
+		if(status != SIMPLESD_OK) {
+			/* Flash Erase error */
+			return status;
+		}
+#else
+		EraseStruct.Sector = current_sector;
+		if(HAL_FLASHEx_Erase(&EraseStruct, &sectorError) != HAL_OK) {
+			/* Flash Erase error */
+			return SIMPLESD_FLASH_ERASE_ERROR;
+		}
+#endif
+		SimpleSD_Statistics.ErasedSectors++;
+#if SD_WATCHDOG_RUNNING
+		HAL_IWDG_Refresh(&hiwdg);
+#endif
+	}
+	return SIMPLESD_OK;
+}
+
+#if SIMPLESD_BLANK_CHECK
+/*
+ * @brief  Checks if a sector is erased, stopping at the first programmed word
+ * @param  Sector: The sector to check
+ * @retval 1: All words of the sector are 0xFFFFFFFF
+ * 		   0: The sector must be erased
+ */
+static uint8_t SimpleSD_SectorBlank(uint32_t Sector)
+{
+	const uint32_t *address, *end;
+	uint32_t StartTime, blank = 0xFFFFFFFF;
+
+	StartTime = SimpleSD_TimeStamp();
+	address = (const uint32_t *)SimpleSD_FlashGeometry[Sector].Base;
+	end     = (const uint32_t *)(SimpleSD_FlashGeometry[Sector].Base + SimpleSD_FlashGeometry[Sector].Size);
+	/* Four words per step, the AND of erased words stays 0xFFFFFFFF */
+	while((address < end) && (blank == 0xFFFFFFFF)) {
+		blank = address[0] & address[1] & address[2] & address[3];
+		address += 4;
+	}
+	SimpleSD_Statistics.BlankCheckTime += SimpleSD_ElapsedTime(StartTime);
+	return (blank == 0xFFFFFFFF);
+}
+#endif
+
+#if SIMPLESD_ERASE_OVERLAP
+/*
+ * @brief  Starts erasing a sector. The function returns immediately, the end of the erase is
+ *         handled by SimpleSD_FLASH_IRQHandler() and collected with SimpleSD_ProgramWait()
+ * @param  Sector: The sector to erase
+ * @retval None
+ */
+static void SimpleSD_EraseStart(uint32_t Sector)
+{
+	/* Sectors of Bank 2 are numbered from 16 in the SNB field */
+	if(SimpleSD_FlashGeometry[Sector].Bank == 2) {
+		Sector += 4U;
+	}
+	Program_Erase = 1;
+	Program_Status = SIMPLESD_PROGRAM_BUSY;
+
+	/* Parallelism of the voltage range, end of operation and error interrupts */
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PSIZE | FLASH_CR_SNB);
+	SET_BIT(FLASH->CR, SIMPLESD_PROGRAM_PSIZE | FLASH_CR_SER | (Sector << FLASH_CR_SNB_Pos) | FLASH_IT_EOP | FLASH_IT_ERR);
+	SET_BIT(FLASH->CR, FLASH_CR_STRT);
+}
+
+/*
+ * @brief  Empties the read-ahead buffer. The file must be positioned at the offset of Address
+ * @param  Address: Flash address of the next byte of the file
+ * 		   EndAddress: Read ahead stops at this address
+ * @retval None
+ */
+static void SimpleSD_PrefetchReset(uint32_t Address, uint32_t EndAddress)
+{
+	Prefetch_Start = Address;
+	Prefetch_End   = Address;
+	Prefetch_Limit = EndAddress;
+}
+
+/*
+ * @brief  Reads the next block of the file into the read-ahead buffer, if there is room left
+ * @param  None
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success or buffer full
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
+ */
+static uint8_t SimpleSD_Prefetch(void)
+{
+	UINT Bytes;
+	uint32_t Length, Offset, StartTime;
+
+	Offset = Prefetch_End - Prefetch_Start;
+	Length = Prefetch_Limit - Prefetch_End;
+	if(Length > SIMPLESD_READ_BUFFER_SIZE) {
+		Length = SIMPLESD_READ_BUFFER_SIZE;
+	}
+	if(Length > SIMPLESD_PREFETCH_SIZE - Offset) {
+		Length = SIMPLESD_PREFETCH_SIZE - Offset;
+	}
+	if(Length == 0) {
+		return SIMPLESD_OK;
+	}
+
+	StartTime = SimpleSD_TimeStamp();
+	fresult = SimpleSD_ImageRead((uint8_t *)SimpleSD_PrefetchBuffer + Offset, Length, &Bytes);
+	SimpleSD_Statistics.ReadTime += SimpleSD_ElapsedTime(StartTime);
+	if((Bytes != Length) || (fresult != FR_OK)) {
+		/* FS Read error */
+		return SIMPLESD_FS_READ_ERROR;
+	}
+	SimpleSD_Statistics.BytesRead += Bytes;
+	SimpleSD_Statistics.PrefetchedBytes += Bytes;
+	Prefetch_End += Bytes;
+	return SIMPLESD_OK;
+}
+#endif
+
+/*
+ * @brief  Identifies the opened firmware file. The block index of a compressed file is read,
+ *         an uncompressed file is positioned back to its start
+ * @param  None
+ * @retval FR_OK or the FatFs error, FR_INT_ERR for a damaged compressed file
+ */
+static FRESULT SimpleSD_ImageOpen(void)
+{
+#if SIMPLESD_LZ4
+	UINT Bytes;
+	uint32_t Header[SIMPLESD_LZ4_HEADER_SIZE / 4];
+
+	Lz4_Enabled = 0;
+	fresult = f_read(&SimpleSD_file, Header, sizeof(Header), &Bytes);
+	if(fresult != FR_OK) {
+		return fresult;
+	}
+	if((Bytes != sizeof(Header)) || (Header[0] != SIMPLESD_LZ4_MAGIC)) {
+		/* Uncompressed file */
+		return f_lseek(&SimpleSD_file, 0);
+	}
+
+	Lz4_Size      = Header[1];
+	Lz4_BlockSize = Header[2];
+	Lz4_Blocks    = Header[3];
+	if((Lz4_BlockSize == 0) || (Lz4_BlockSize > SIMPLESD_LZ4_BLOCK_SIZE) || (Lz4_BlockSize % sizeof(uint32_t)) ||
+	   (Lz4_Blocks > SIMPLESD_LZ4_MAX_BLOCKS) || (Lz4_Blocks != (Lz4_Size + Lz4_BlockSize - 1) / Lz4_BlockSize)) {
+		return FR_INT_ERR;
+	}
+	fresult = f_read(&SimpleSD_file, Lz4_Index, (Lz4_Blocks + 1) * sizeof(uint32_t), &Bytes);
+	if(fresult != FR_OK) {
+		return fresult;
+	}
+	if((Bytes != (Lz4_Blocks + 1) * sizeof(uint32_t)) || (Lz4_Index[Lz4_Blocks] != f_size(&SimpleSD_file))) {
+		return FR_INT_ERR;
+	}
+	Lz4_Position = 0;
+	Lz4_Loaded = 0xFFFFFFFF;
+	Lz4_Enabled = 1;
+#endif
+	return FR_OK;
+}
+
+/*
+ * @brief  Reads the firmware file, decompressing a compressed file, like f_read()
+ * @param  Data: Buffer for the data
+ * 		   Length: Number of bytes to read
+ * 		   Bytes: Set to the number of bytes read, less than Length at the end of the file
+ * @retval FR_OK or the FatFs error, FR_INT_ERR for a damaged compressed file
+ */
+static FRESULT SimpleSD_StreamRead(void *Data, UINT Length, UINT *Bytes)
+{
+#if SIMPLESD_LZ4
+	FRESULT result;
+	uint8_t *Destination = Data;
+	uint32_t Block, Offset, Size, Part;
+
+	if(Lz4_Enabled) {
+		*Bytes = 0;
+		while((Length != 0) && (Lz4_Position < Lz4_Size))
+		{
+			Block  = Lz4_Position / Lz4_BlockSize;
+			Offset = Lz4_Position % Lz4_BlockSize;
+			Size   = Lz4_Size - Block * Lz4_BlockSize;
+			if(Size > Lz4_BlockSize) {
+				Size = Lz4_BlockSize;
+			}
+
+			if((Offset == 0) && (Length >= Size)) {
+				/* Whole block, decompressed straight into the destination */
+				result = SimpleSD_LZ4_Load(Block, Destination, Size);
+				if(result != FR_OK) {
+					return result;
+				}
+				Part = Size;
+			}
+			else {
+				if(Block != Lz4_Loaded) {
+					result = SimpleSD_LZ4_Load(Block, (uint8_t *)Lz4_Output, Size);
+					if(result != FR_OK) {
+						return result;
+					}
+					Lz4_Loaded = Block;
+				}
+				Part = Size - Offset;
+				if(Part > Length) {
+					Part = Length;
+				}
+				memcpy(Destination, (uint8_t *)Lz4_Output + Offset, Part);
+			}
+			Destination  += Part;
+			Lz4_Position += Part;
+			Length       -= Part;
+			*Bytes       += Part;
+		}
+		return FR_OK;
+	}
+#endif
+	return f_read(&SimpleSD_file, Data, Length, Bytes);
+}
+
+/*
+ * @brief  Moves the read position in the firmware file, decompressed if compressed, like f_lseek()
+ * @param  Offset: Offset in the decompressed file
+ * @retval FR_OK or the FatFs error
+ */
+static FRESULT SimpleSD_StreamSeek(uint32_t Offset)
+{
+#if SIMPLESD_LZ4
+	if(Lz4_Enabled) {
+		/* The block is read when the position is read */
+		if(Offset > Lz4_Size) {
+			return FR_INVALID_PARAMETER;
+		}
+		Lz4_Position = Offset;
+		return FR_OK;
+	}
+#endif
+	return f_lseek(&SimpleSD_file, Offset);
+}
+
+/*
+ * @brief  Size of the firmware file, decompressed if compressed, like f_size()
+ * @param  None
+ * @retval Size in bytes
+ */
+static uint32_t SimpleSD_StreamSize(void)
+{
+#if SIMPLESD_LZ4
+	if(Lz4_Enabled) {
+		return Lz4_Size;
+	}
+#endif
+	return f_size(&SimpleSD_file);
+}
+
+/*
+ * @brief  Reads the image held by the firmware file, like f_read()
+ * @param  Data: Buffer for the data
+ * 		   Length: Number of bytes to read
+ * 		   Bytes: Set to the number of bytes read, less than Length at the end of the image
+ * @retval FR_OK or the FatFs error, FR_INT_ERR for a damaged compressed file or patch
+ */
+static FRESULT SimpleSD_ImageRead(void *Data, UINT Length, UINT *Bytes)
+{
+#if SIMPLESD_DELTA
+	if(Delta_Enabled) {
+		return SimpleSD_DeltaRead(Data, Length, Bytes);
+	}
+#endif
+	return SimpleSD_StreamRead(Data, Length, Bytes);
+}
+
+/*
+ * @brief  Moves the read position in the image held by the firmware file, like f_lseek()
+ * @param  Offset: Offset in the image
+ * @retval FR_OK or the FatFs error
+ */
+static FRESULT SimpleSD_ImageSeek(uint32_t Offset)
+{
+#if SIMPLESD_DELTA
+	if(Delta_Enabled) {
+		return SimpleSD_DeltaSeek(Offset);
+	}
+#endif
+	return SimpleSD_StreamSeek(Offset);
+}
+
+/*
+ * @brief  Size of the image held by the firmware file, like f_size()
+ * @param  None
+ * @retval Size in bytes, including the CRC
+ */
+static uint32_t SimpleSD_ImageFileSize(void)
+{
+#if SIMPLESD_DELTA
+	if(Delta_Enabled) {
+		return Delta_Size;
+	}
+#endif
+	return SimpleSD_StreamSize();
+}
+
+#if SIMPLESD_DELTA
+/*
+ * @brief  Checks if the opened firmware file is a patch. A patch for the installed firmware is applied
+ *         while the file is read, a patch for another firmware is replaced by APPLICATION_FULL_FILENAME
+ * @param  None
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FS_READ_ERROR:		 	  FS Read error
+ *					- SIMPLESD_DELTA_BASE_ERROR:		  Patch for another firmware and no full image
+ */
+static uint8_t SimpleSD_DeltaOpen(void)
+{
+	UINT Bytes;
+	uint32_t Header[SIMPLESD_DELTA_HEADER_SIZE / 4];
+
+	Delta_Enabled = 0;
+	if(SimpleSD_StreamRead(Header, sizeof(Header), &Bytes) != FR_OK) {
+		/* FS Read error */
+		return SIMPLESD_FS_READ_ERROR;
+	}
+	if((Bytes != sizeof(Header)) || (Header[0] != SIMPLESD_DELTA_MAGIC)) {
+		/* Full image */
+		return (SimpleSD_StreamSeek(0) == FR_OK) ? SIMPLESD_OK : SIMPLESD_FS_READ_ERROR;
+	}
+
+	/* The patch applies to the installed firmware if its CRC word and its size match. No CRC is calculated
+	 * before the first read, a damaged installed firmware gives a rebuilt image with a wrong CRC */
+	Delta_Base     = SimpleSD_ActiveSlot();
+	Delta_BaseSize = Header[2];
+	Delta_Size     = Header[3];
+	if((SimpleSD_SlotImageSize(Delta_Base) == Delta_BaseSize) && (*(uint32_t *)(Delta_Base + Delta_BaseSize) == Header[1])) {
+		Delta_Enabled = 1;
+		return (SimpleSD_DeltaRestart() == FR_OK) ? SIMPLESD_OK : SIMPLESD_FS_READ_ERROR;
+	}
+
+	/* Patch for another firmware, install the full image instead */
+	f_close(&SimpleSD_file);
+	if(f_open(&SimpleSD_file, APPLICATION_FULL_FILENAME, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+		return SIMPLESD_DELTA_BASE_ERROR;
+	}
+	return (SimpleSD_ImageOpen() == FR_OK) ? SIMPLESD_OK : SIMPLESD_FS_READ_ERROR;
+}
+
+/*
+ * @brief  Starts applying the patch from the start of the image
+ * @param  None
+ * @retval FR_OK or the FatFs error
+ */
+static FRESULT SimpleSD_DeltaRestart(void)
+{
+	Delta_Position = 0;
+	Delta_Old      = 0;
+	Delta_Diff     = 0;
+	Delta_Extra    = 0;
+	Delta_Seek     = 0;
+	Delta_Stream   = SIMPLESD_DELTA_HEADER_SIZE;
+	return SimpleSD_StreamSeek(Delta_Stream);
+}
+
+/*
+ * @brief  Reads the next control of the patch, after moving in the base image by the seek of the previous one
+ * @param  None
+ * @retval FR_OK or the FatFs error, FR_INT_ERR for a control out of the base or the new image
+ */
+static FRESULT SimpleSD_DeltaControl(void)
+{
+	UINT Bytes;
+	FRESULT result;
+	uint32_t Control[3];
+
+	Delta_Old += (uint32_t)Delta_Seek;
+	result = SimpleSD_StreamRead(Control, sizeof(Control), &Bytes);
+	if(result != FR_OK) {
+		return result;
+	}
+	if(Bytes != sizeof(Control)) {
+		return FR_INT_ERR;
+	}
+	Delta_Stream += Bytes;
+	SimpleSD_Statistics.PatchBytes += Bytes;
+
+	Delta_Diff  = Control[0];
+	Delta_Extra = Control[1];
+	Delta_Seek  = (int32_t)Control[2];
+	if((Delta_Old > Delta_BaseSize) || (Delta_Diff > Delta_BaseSize - Delta_Old) ||
+	   (Delta_Diff > Delta_Size - Delta_Position) || (Delta_Extra > Delta_Size - Delta_Position - Delta_Diff)) {
+		return FR_INT_ERR;
+	}
+	return FR_OK;
+}
+
+/*
+ * @brief  Rebuilds the next bytes of the new image from the patch and the base image
+ * @param  Data: Buffer for the data, NULL to skip the bytes without reading the patch
+ * 		   Length: Number of bytes to read
+ * 		   Bytes: Set to the number of bytes read, less than Length at the end of the image
+ * @retval FR_OK or the FatFs error, FR_INT_ERR for a damaged patch
+ */
+static FRESULT SimpleSD_DeltaRead(void *Data, UINT Length, UINT *Bytes)
+{
+	UINT Part, Read;
+	FRESULT result;
+	uint8_t *Destination = Data;
+	const uint8_t *Old;
+	uint32_t i, a, b;
+
+	*Bytes = 0;
+	while((Length != 0) && (Delta_Position < Delta_Size))
+	{
+		if((Delta_Diff == 0) && (Delta_Extra == 0)) {
+			result = SimpleSD_DeltaControl();
+			if(result != FR_OK) {
+				return result;
+			}
+			continue;
+		}
+
+		/* Diff bytes first, then extra bytes */
+		Part = (Delta_Diff != 0) ? Delta_Diff : Delta_Extra;
+		if(Part > Length) {
+			Part = Length;
+		}
+		Delta_Stream += Part;
+		if(Destination == NULL) {
+			result = SimpleSD_StreamSeek(Delta_Stream);
+			if(result != FR_OK) {
+				return result;
+			}
+		}
+		else {
+			result = SimpleSD_StreamRead(Destination, Part, &Read);
+			if((result != FR_OK) || (Read != Part)) {
+				return (result != FR_OK) ? result : FR_INT_ERR;
+			}
+			SimpleSD_Statistics.PatchBytes += Read;
+			if(Delta_Diff != 0) {
+				/* Add the base image byte by byte, four bytes per step */
+				Old = (const uint8_t *)(Delta_Base + Delta_Old);
+				for(i = 0; i + 4 <= Part; i += 4) {
+					memcpy(&a, Destination + i, 4);
+					memcpy(&b, Old + i, 4);
+					a = ((a & 0x7F7F7F7F) + (b & 0x7F7F7F7F)) ^ ((a ^ b) & 0x80808080);
+					memcpy(Destination + i, &a, 4);
+				}
+				for(; i < Part; i++) {
+					Destination[i] += Old[i];
+				}
+			}
+			Destination += Part;
+		}
+
+		if(Delta_Diff != 0) {
+			Delta_Old  += Part;
+			Delta_Diff -= Part;
+		}
+		else {
+			Delta_Extra -= Part;
+		}
+		Delta_Position += Part;
+		Length         -= Part;
+		*Bytes         += Part;
+	}
+	return FR_OK;
+}
+
+/*
+ * @brief  Moves the read position in the new image. Moving back applies the patch again from its
+ *         start, moving forward reads only the controls of the patch
+ * @param  Offset: Offset in the new image
+ * @retval FR_OK or the FatFs error
+ */
+static FRESULT SimpleSD_DeltaSeek(uint32_t Offset)
+{
+	UINT Bytes;
+	FRESULT result;
+
+	if(Offset > Delta_Size) {
+		return FR_INVALID_PARAMETER;
+	}
+	if(Offset < Delta_Position) {
+		result = SimpleSD_DeltaRestart();
+		if(result != FR_OK) {
+			return result;
+		}
+	}
+	return SimpleSD_DeltaRead(NULL, Offset - Delta_Position, &Bytes);
+}
+#endif
+
+#if SIMPLESD_LZ4
+/*
+ * @brief  Reads a block of the compressed file and decompresses it
+ * @param  Block: The block to read
+ * 		   Data: Buffer for the decompressed block
+ * 		   Size: Size of the decompressed block
+ * @retval FR_OK or the FatFs error, FR_INT_ERR for a damaged block
+ */
+static FRESULT SimpleSD_LZ4_Load(uint32_t Block, uint8_t *Data, uint32_t Size)
+{
+	UINT Bytes;
+	FRESULT result;
+	uint32_t Compressed, StartTime;
+
+	Compressed = Lz4_Index[Block + 1] - Lz4_Index[Block];
+	if((Compressed == 0) || (Compressed > Size)) {
+		return FR_INT_ERR;
+	}
+	if(f_tell(&SimpleSD_file) != Lz4_Index[Block]) {
+		result = f_lseek(&SimpleSD_file, Lz4_Index[Block]);
+		if(result != FR_OK) {
+			return result;
+		}
+	}
+
+	/* A stored block is read straight into the destination */
+	result = f_read(&SimpleSD_file, (Compressed == Size) ? Data : (uint8_t *)Lz4_Input, Compressed, &Bytes);
+	if((result != FR_OK) || (Bytes != Compressed)) {
+		return (result != FR_OK) ? result : FR_INT_ERR;
+	}
+	SimpleSD_Statistics.CompressedBytes += Compressed;
+
+	if(Compressed < Size) {
+		StartTime = SimpleSD_TimeStamp();
+		Bytes = SimpleSD_LZ4_Decode((const uint8_t *)Lz4_Input, Compressed, Data, Size);
+		SimpleSD_Statistics.DecodeTime += SimpleSD_ElapsedTime(StartTime);
+		if(Bytes != Size) {
+			return FR_INT_ERR;
+		}
+	}
+	return FR_OK;
+}
+
+/*
+ * @brief  Decompresses a LZ4 block. Every length and offset is checked, a damaged block can not
+ *         write outside of the destination
+ * @param  Source: The compressed block
+ * 		   SourceSize: Size of the compressed block
+ * 		   Data: Buffer for the decompressed data
+ * 		   Size: Size of the buffer
+ * @retval Size of the decompressed data, 0 if the block is damaged
+ */
+static uint32_t SimpleSD_LZ4_Decode(const uint8_t *Source, uint32_t SourceSize, uint8_t *Data, uint32_t Size)
+{
+	const uint8_t *input = Source, *input_end = Source + SourceSize, *match;
+	uint8_t *output = Data, *output_end = Data + Size;
+	uint32_t token, length, offset;
+
+	while(input < input_end)
+	{
+		token = *input++;
+
+		/* Literals */
+		length = token >> 4;
+		if(length == 15) {
+			do {
+				if(input >= input_end) {
+					return 0;
+				}
+				length += *input;
+			} while(*input++ == 255);
+		}
+		if((length > (uint32_t)(input_end - input)) || (length > (uint32_t)(output_end - output))) {
+			return 0;
+		}
+		memcpy(output, input, length);
+		output += length;
+		input  += length;
+		if(input == input_end) {
+			/* The last sequence has no match */
+			break;
+		}
+
+		/* Match: offset back in the decompressed data, then length */
+		if(input_end - input < 2) {
+			return 0;
+		}
+		offset = input[0] | (input[1] << 8);
+		input += 2;
+		if((offset == 0) || (offset > (uint32_t)(output - Data))) {
+			return 0;
+		}
+		length = token & 0x0F;
+		if(length == 15) {
+			do {
+				if(input >= input_end) {
+					return 0;
+				}
+				length += *input;
+			} while(*input++ == 255);
+		}
+		length += 4;
+		if(length > (uint32_t)(output_end - output)) {
+			return 0;
+		}
+		match = output - offset;
+		if(offset >= length) {
+			memcpy(output, match, length);
+			output += length;
+		}
+		else {
+			/* Overlapping match, repeats the last offset bytes */
+			while(length--) {
+				*output++ = *match++;
+			}
+		}
+	}
+	return output - Data;
+}
+#endif
+
+/*
+ * @brief  Stops an ongoing firmware upgrade after an error
+ * @param  ErrorCode: The error that stopped the upgrade
+ * @retval ErrorCode
+ */
+static uint8_t SimpleSD_UpgradeAbort(uint8_t ErrorCode)
+{
+	/* Let the programmer finish the block in progress */
+	SimpleSD_ProgramWait();
+#if SIMPLESD_PIPELINE_ENABLED
+	HAL_NVIC_DisableIRQ(FLASH_IRQn);
+#endif
+#if SIMPLESD_JOURNAL
+	if(ErrorCode == SIMPLESD_IMAGE_CRC_ERROR) {
+		/* The file or the part of the flash kept from an interrupted upgrade is wrong, start over next time */
+		SimpleSD_JournalWrite(SIMPLESD_JOURNAL_DONE);
+	}
+#endif
+	/* De-initialization of SD-FileSystem */
+	SimpleSD_DeInit();
+	/* Locks the FLASH control register access. */
+	HAL_FLASH_Lock();
+	return ErrorCode;
+}
+
+/*
+ * @brief  Ends the programming of a firmware whose CRC has been checked. In the dual bank layout the
+ *         sequence number is programmed after the CRC, the sector it starts is erased first. That erase
+ *         may still be driven by the FLASH interrupt, so the interrupt is only disabled afterwards
+ * @param  EndAddress: End of the image and its CRC
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error
+ */
+static uint8_t SimpleSD_UpgradeFinish(uint32_t EndAddress)
+{
+#if SIMPLESD_DUAL_BANK
+	uint8_t status;
+
+	/* Make the new slot the newest one. The CRC has been checked, so it is booted from now on */
+	status = SimpleSD_EraseAhead(EndAddress, EndAddress);
+	if(status != SIMPLESD_OK) {
+		return status;
+	}
+	if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, EndAddress,
+						 SimpleSD_SequenceNext(SimpleSD_SlotSequence(SimpleSD_ActiveSlot()))) != HAL_OK) {
+		return SIMPLESD_FLASH_WRITE_ERROR;
+	}
+	Slot_Active = 0;
+#else
+	(void)EndAddress;
+#endif
+#if SIMPLESD_PIPELINE_ENABLED
+	HAL_NVIC_DisableIRQ(FLASH_IRQn);
+#endif
+#if SIMPLESD_JOURNAL
+	SimpleSD_JournalWrite(SIMPLESD_JOURNAL_DONE);
+#endif
+	return SIMPLESD_OK;
+}
+
+/*
+ * @brief  Starts programming a block of words to the flash. With the pipeline enabled the
+ *         function returns immediately and the block is programmed from the FLASH interrupt,
+ *         otherwise the block is programmed before the function returns.
+ *         The result is collected with SimpleSD_ProgramWait()
+ * @param  Address: Flash address of the first word
+ * 		   Data: The words to program. Must stay untouched until the block is programmed
+ * 		   Words: Number of words to program
+ * @retval None
+ */
+static void SimpleSD_ProgramStart(uint32_t Address, const uint32_t *Data, uint32_t Words)
+{
+	if(Words == 0) {
+		return;
+	}
+
+	Program_Address   = Address;
+	Program_Data      = Data;
+	Program_Remaining = Words;
+	Program_StartTime = SimpleSD_TimeStamp();
+
+	Program_BlockAddress = Address;
+	Program_BlockData    = Data;
+	Program_BlockWords   = Words;
+
+#if SIMPLESD_PIPELINE_ENABLED
+	if(SimpleSD_SkipErasedWords() == 0) {
+		/* Nothing but erased words in the block */
+		SimpleSD_Statistics.ProgramTime += SimpleSD_ElapsedTime(Program_StartTime);
+		return;
+	}
+	Program_Status = SIMPLESD_PROGRAM_BUSY;
+
+	/* Word parallelism, end of operation and error interrupts */
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PSIZE);
+	SET_BIT(FLASH->CR, FLASH_PSIZE_WORD | FLASH_CR_PG | FLASH_IT_EOP | FLASH_IT_ERR);
+
+	/* Program the first word, the rest are programmed from SimpleSD_FLASH_IRQHandler() */
+	SimpleSD_ProgramNext();
+#elif SIMPLESD_PROGRAM_ENGINE == SIMPLESD_PROGRAM_USING_REGISTERS
+	Program_Status = SimpleSD_ProgramBlock(Address, Data, Words);
+#else
+	while(SimpleSD_SkipErasedWords()) {
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, Program_Address, *Program_Data) != HAL_OK) {
+			/* Flash Write error */
+			Program_Status = SIMPLESD_FLASH_WRITE_ERROR;
+			break;
+		}
+		Program_Address += sizeof(uint32_t);
+		Program_Data++;
+		Program_Remaining--;
+	}
+	SimpleSD_Statistics.ProgramTime += SimpleSD_ElapsedTime(Program_StartTime);
+#endif
+}
+
+#if SIMPLESD_PIPELINE_ENABLED
+/*
+ * @brief  Writes the next word to the flash, or the next two words when the parallelism is x64
+ *         and the address is double word aligned. The end of the operation raises the FLASH interrupt
+ * @param  None
+ * @retval None
+ */
+static void SimpleSD_ProgramNext(void)
+{
+#if SIMPLESD_PROGRAM_PSIZE == FLASH_PSIZE_DOUBLE_WORD
+	if((Program_Remaining > 1) && !(Program_Address & 7)) {
+		MODIFY_REG(FLASH->CR, FLASH_CR_PSIZE, FLASH_PSIZE_DOUBLE_WORD);
+		Program_Step = 2;
+		*(__IO uint32_t*)Program_Address = Program_Data[0];
+		__ISB();
+		*(__IO uint32_t*)(Program_Address + 4) = Program_Data[1];
+		return;
+	}
+	MODIFY_REG(FLASH->CR, FLASH_CR_PSIZE, FLASH_PSIZE_WORD);
+#endif
+	Program_Step = 1;
+	*(__IO uint32_t*)Program_Address = *Program_Data;
+}
+#endif
+
+/*
+ * @brief  Programs a block of words at the widest parallelism, polling BSY instead of going through
+ *         HAL_FLASH_Program() and its HAL_GetTick() timeout for every word. Runs from RAM, so the
+ *         loop does not stall on instruction fetches from the flash being programmed.
+ *         The engine of SIMPLESD_PROGRAM_USING_REGISTERS, also measured by SimpleSD_Program_Benchmark()
+ * @param  Address: Flash address of the first word
+ * 		   Data: The words to program
+ * 		   Words: Number of words to program
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error
+ */
+__attribute__((section(".RamFunc"), noinline, long_call))
+static uint8_t SimpleSD_ProgramBlock(uint32_t Address, const uint32_t *Data, uint32_t Words)
+{
+	uint8_t status = SIMPLESD_OK;
+	uint32_t step;
+#if SIMPLESD_PROGRAM_PSIZE < FLASH_PSIZE_WORD
+	uint32_t part;
+#endif
+
+	MODIFY_REG(FLASH->CR, FLASH_CR_PSIZE, SIMPLESD_PROGRAM_PSIZE);
+	SET_BIT(FLASH->CR, FLASH_CR_PG);
+
+	while(Words) {
+#if SIMPLESD_SKIP_ERASED_WORDS
+		if(*Data == 0xFFFFFFFF) {
+			/* Already the erased value */
+			SimpleSD_Statistics.ErasedWords++;
+			Address += sizeof(uint32_t);
+			Data++;
+			Words--;
+			continue;
+		}
+#endif
+
+#if SIMPLESD_PROGRAM_PSIZE == FLASH_PSIZE_DOUBLE_WORD
+		/* Two words at once when double word aligned, the last or a lone word with x32 */
+		step = ((Words > 1) && !(Address & 7)) ? 2 : 1;
+		MODIFY_REG(FLASH->CR, FLASH_CR_PSIZE, (step == 2) ? FLASH_PSIZE_DOUBLE_WORD : FLASH_PSIZE_WORD);
+		*(__IO uint32_t*)Address = Data[0];
+		if(step == 2) {
+			__ISB();
+			*(__IO uint32_t*)(Address + 4) = Data[1];
+		}
+		while(FLASH->SR & FLASH_SR_BSY);
+#elif SIMPLESD_PROGRAM_PSIZE == FLASH_PSIZE_WORD
+		step = 1;
+		*(__IO uint32_t*)Address = *Data;
+		while(FLASH->SR & FLASH_SR_BSY);
+#else
+		/* One operation per byte [x8] or half word [x16] */
+		step = 1;
+		for(part = 0; part < sizeof(uint32_t); part += (SIMPLESD_PROGRAM_PSIZE == FLASH_PSIZE_BYTE) ? 1 : 2) {
+#if SIMPLESD_PROGRAM_PSIZE == FLASH_PSIZE_BYTE
+			*(__IO uint8_t*)(Address + part) = (uint8_t)(*Data >> (8 * part));
+#else
+			*(__IO uint16_t*)(Address + part) = (uint16_t)(*Data >> (8 * part));
+#endif
+			while(FLASH->SR & FLASH_SR_BSY);
+			if(FLASH->SR & SIMPLESD_FLASH_ERRORS) {
+				break;
+			}
+		}
+#endif
+
+		if(FLASH->SR & SIMPLESD_FLASH_ERRORS) {
+			/* Flash Write error */
+			__HAL_FLASH_CLEAR_FLAG(SIMPLESD_FLASH_ERRORS);
+			status = SIMPLESD_FLASH_WRITE_ERROR;
+			break;
+		}
+		Address += step * sizeof(uint32_t);
+		Data += step;
+		Words -= step;
+	}
+
+	CLEAR_BIT(FLASH->CR, FLASH_CR_PG);
+	return status;
+}
+
+/*
+ * @brief  Measures the programming of one read buffer [SIMPLESD_READ_BUFFER_SIZE] with HAL_FLASH_Program()
+ *         for every word, with the loop running from SRAM and, with the pipeline enabled, from the FLASH
+ *         interrupt. Uses the last flash sector and leaves it erased, refused when a firmware reaches it
+ * @param  Result: Timing of the engines
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_IMAGE_SIZE_ERROR:		  Installed firmware reaches the last sector
+ *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error
+ *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error
+ */
+uint8_t SimpleSD_Program_Benchmark(SimpleSD_ProgramBenchmarkTypeDef *Result)
+{
+#if SIMPLESD_DUAL_BANK
+	const uint32_t Slots[] = { SIMPLESD_SLOT_A_ADDRESS, SIMPLESD_SLOT_B_ADDRESS };
+#else
+	const uint32_t Slots[] = { APPLICATION_START_ADDRESS };
+#endif
+	SimpleSD_StatisticsTypeDef Statistics = SimpleSD_Statistics;
+	FLASH_EraseInitTypeDef EraseStruct;
+	uint32_t StartTime, Address, sectorError, i;
+	uint32_t *Data = SimpleSD_ReadBuffer[0];
+	uint8_t status = SIMPLESD_OK;
+
+	memset(Result, 0, sizeof(*Result));
+	Result->Words = SIMPLESD_READ_BUFFER_SIZE / 4;
+	Result->Sector = SIMPLESD_FLASH_SECTORS - 1;
+	Address = SimpleSD_FlashGeometry[Result->Sector].Base;
+
+	for(i = 0; i < sizeof(Slots) / sizeof(Slots[0]); i++) {
+		if((*(__IO uint32_t*)Slots[i] != 0xFFFFFFFF) &&
+		   (Slots[i] + SimpleSD_SlotImageSize(Slots[i]) + APPLICATION_CRC_SIZE + SIMPLESD_SLOT_RECORD_SIZE > Address)) {
+			/* The firmware or its CRC is in the sector */
+			return SIMPLESD_IMAGE_SIZE_ERROR;
+		}
+	}
+
+	/* No word equal to the erased value, all of them are programmed */
+	for(i = 0; i < Result->Words; i++) {
+		Data[i] = 0x5A5A0000 | i;
+	}
+
+	SimpleSD_TimerStart();
+	HAL_FLASH_Unlock();
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR | FLASH_FLAG_BSY);
+
+	EraseStruct.TypeErase = FLASH_TYPEERASE_SECTORS;
+	EraseStruct.VoltageRange = SIMPLESD_VOLTAGE_RANGE;
+	EraseStruct.Sector = Result->Sector;
+	EraseStruct.NbSectors = 1;
+	if(HAL_FLASHEx_Erase(&EraseStruct, &sectorError) != HAL_OK) {
+		HAL_FLASH_Lock();
+		/* Flash Erase error */
+		return SIMPLESD_FLASH_ERASE_ERROR;
+	}
+#if SD_WATCHDOG_RUNNING
+	HAL_IWDG_Refresh(&hiwdg);
+#endif
+
+	/* HAL_FLASH_Program() for every word */
+	StartTime = SimpleSD_TimeStamp();
+	for(i = 0; i < Result->Words; i++) {
+		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, Address + i * sizeof(uint32_t), Data[i]) != HAL_OK) {
+			/* Flash Write error */
+			status = SIMPLESD_FLASH_WRITE_ERROR;
+			break;
+		}
+	}
+	Result->HALTime = SimpleSD_ElapsedTime(StartTime);
+	if(status == SIMPLESD_OK) {
+		status = SimpleSD_VerifyBlock(Address, Data, Result->Words);
+	}
+	Address += SIMPLESD_READ_BUFFER_SIZE;
+#if SD_WATCHDOG_RUNNING
+	HAL_IWDG_Refresh(&hiwdg);
+#endif
+
+	/* Loop running from SRAM */
+	if(status == SIMPLESD_OK) {
+		StartTime = SimpleSD_TimeStamp();
+		status = SimpleSD_ProgramBlock(Address, Data, Result->Words);
+		Result->RAMTime = SimpleSD_ElapsedTime(StartTime);
+	}
+	if(status == SIMPLESD_OK) {
+		status = SimpleSD_VerifyBlock(Address, Data, Result->Words);
+	}
+	Address += SIMPLESD_READ_BUFFER_SIZE;
+
+#if SIMPLESD_PIPELINE_ENABLED
+	/* FLASH interrupt, the way the upgrade programs */
+	if(status == SIMPLESD_OK) {
+		HAL_NVIC_SetPriority(FLASH_IRQn, SIMPLESD_FLASH_IRQ_PRIORITY, 0);
+		HAL_NVIC_EnableIRQ(FLASH_IRQn);
+		Program_Status = SIMPLESD_OK;
+		StartTime = SimpleSD_TimeStamp();
+		SimpleSD_ProgramStart(Address, Data, Result->Words);
+		status = SimpleSD_ProgramWait();
+		Result->InterruptTime = SimpleSD_ElapsedTime(StartTime);
+		HAL_NVIC_DisableIRQ(FLASH_IRQn);
+	}
+#endif
+
+	/* Leave the sector erased */
+	if((HAL_FLASHEx_Erase(&EraseStruct, &sectorError) != HAL_OK) && (status == SIMPLESD_OK)) {
+		/* Flash Erase error */
+		status = SIMPLESD_FLASH_ERASE_ERROR;
+	}
+	HAL_FLASH_Lock();
+
+	/* The engines count into the statistics of the last upgrade */
+	SimpleSD_Statistics = Statistics;
+	return status;
+}
+
+#if SIMPLESD_PIPELINE_ENABLED || (SIMPLESD_PROGRAM_ENGINE == SIMPLESD_PROGRAM_USING_HAL)
+/*
+ * @brief  Moves the programming position over the words equal to the erased value. The flash
+ *         already holds 0xFFFFFFFF there, so they need neither programming nor a read back.
+ *         The words have been accounted in the CRC before the block was handed over
+ * @param  None
+ * @retval Number of words left to program, starting with a word to write
+ */
+static uint32_t SimpleSD_SkipErasedWords(void)
+{
+#if SIMPLESD_SKIP_ERASED_WORDS
+	const uint32_t *data = Program_Data;
+	uint32_t remaining = Program_Remaining;
+
+	while(remaining && (*data == 0xFFFFFFFF)) {
+		data++;
+		remaining--;
+	}
+	if(remaining != Program_Remaining) {
+		SimpleSD_Statistics.ErasedWords += Program_Remaining - remaining;
+		Program_Address += (uint32_t)(data - Program_Data) * sizeof(uint32_t);
+		Program_Data = data;
+		Program_Remaining = remaining;
+	}
+#endif
+	return Program_Remaining;
+}
+#endif
+
+/*
+ * @brief  Waits until the block passed to SimpleSD_ProgramStart() has been programmed
+ * @param  None
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FLASH_ERASE_ERROR:	 	  Flash Erase error or timeout
+ *					- SIMPLESD_FLASH_WRITE_ERROR:	 	  Flash Write error or timeout
+ *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error
+ */
+static uint8_t SimpleSD_ProgramWait(void)
+{
+	uint32_t StartTime;
+#if SIMPLESD_PIPELINE_ENABLED
+	uint32_t Tick = HAL_GetTick();
+#endif
+
+	while(Program_Status == SIMPLESD_PROGRAM_BUSY) {
+#if SIMPLESD_PIPELINE_ENABLED
+		if((HAL_GetTick() - Tick) > SIMPLESD_FLASH_TIMEOUT) {
+			/* No end of operation, stop the interrupt from driving the flash */
+			HAL_NVIC_DisableIRQ(FLASH_IRQn);
+			CLEAR_BIT(FLASH->CR, FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB | FLASH_IT_EOP | FLASH_IT_ERR);
+			if(Program_Status == SIMPLESD_PROGRAM_BUSY) {
+				/* Flash Erase or Write error */
+				Program_Status = Program_Erase ? SIMPLESD_FLASH_ERASE_ERROR : SIMPLESD_FLASH_WRITE_ERROR;
+			}
+			Program_Erase = 0;
+			break;
+		}
+#endif
+#if SD_WATCHDOG_RUNNING
+		HAL_IWDG_Refresh(&hiwdg);
+#endif
+	}
+
+	if((Program_Status == SIMPLESD_OK) && Program_BlockWords) {
+		/* Read the whole block back at once, the flash is not read between the programmed words */
+		StartTime = SimpleSD_TimeStamp();
+		if(SimpleSD_VerifyBlock(Program_BlockAddress, Program_BlockData, Program_BlockWords) != SIMPLESD_OK) {
+			/* Flash Data Compare error */
+			Program_Status = SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+		}
+		SimpleSD_Statistics.BlockVerifyTime += SimpleSD_ElapsedTime(StartTime);
+		Program_BlockWords = 0;
+	}
+	return Program_Status;
+}
+
+/*
+ * @brief  Compares a programmed block with the data it has been programmed from
+ * @param  Address: Flash address of the first word
+ * 		   Data: The words programmed
+ * 		   Words: Number of words programmed
+ * @retval enum SimpleSD_ErrorCodes:
+ * 					- SIMPLESD_OK       			 	  Success
+ *					- SIMPLESD_FLASH_WRITE_COMPARE_ERROR: Flash Data Compare error
+ */
+static uint8_t SimpleSD_VerifyBlock(uint32_t Address, const uint32_t *Data, uint32_t Words)
+{
+	const uint32_t *flash = (const uint32_t *)Address;
+
+#if SIMPLESD_BLOCK_VERIFY == SIMPLESD_BLOCK_VERIFY_FULL
+	for(uint32_t i = 0; i < Words; i++) {
+		if(flash[i] != Data[i]) {
+			return SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+		}
+	}
+#elif SIMPLESD_BLOCK_VERIFY == SIMPLESD_BLOCK_VERIFY_SAMPLED
+	/* Every SIMPLESD_VERIFY_SAMPLE_STEP word and the last one */
+	for(uint32_t i = 0; i < Words; i += SIMPLESD_VERIFY_SAMPLE_STEP) {
+		if(flash[i] != Data[i]) {
+			return SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+		}
+	}
+	if(flash[Words - 1] != Data[Words - 1]) {
+		return SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+	}
+#else
+	if(SimpleSD_CRC_Update(0xFFFFFFFF, flash, Words) != SimpleSD_CRC_Update(0xFFFFFFFF, Data, Words)) {
+		return SIMPLESD_FLASH_WRITE_COMPARE_ERROR;
+	}
+#endif
+	return SIMPLESD_OK;
+}
+
+/*
+ * @brief  Handles the FLASH end of operation and error interrupts while a block is programmed.
+ *         Must be called from FLASH_IRQHandler() when SIMPLESD_PIPELINE_ENABLED is set
+ * @param  None
+ * @retval None
+ */
+void SimpleSD_FLASH_IRQHandler(void)
+{
+#if SIMPLESD_PIPELINE_ENABLED
+	uint8_t status = SIMPLESD_PROGRAM_BUSY;
+
+	if(Program_Erase) {
+		/* End of a sector erase */
+		if(FLASH->SR & SIMPLESD_FLASH_ERRORS) {
+			/* Flash Erase error */
+			__HAL_FLASH_CLEAR_FLAG(SIMPLESD_FLASH_ERRORS);
+			status = SIMPLESD_FLASH_ERASE_ERROR;
+		}
+		else if(FLASH->SR & FLASH_FLAG_EOP) {
+			__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP);
+			status = SIMPLESD_OK;
+		}
+		if(status != SIMPLESD_PROGRAM_BUSY) {
+			CLEAR_BIT(FLASH->CR, FLASH_CR_SER | FLASH_CR_SNB | FLASH_IT_EOP | FLASH_IT_ERR);
+			Program_Erase = 0;
+			Program_Status = status;
+		}
+		return;
+	}
+
+	if(FLASH->SR & SIMPLESD_FLASH_ERRORS) {
+		/* Flash Write error */
+		__HAL_FLASH_CLEAR_FLAG(SIMPLESD_FLASH_ERRORS);
+		status = SIMPLESD_FLASH_WRITE_ERROR;
+	}
+	else if(FLASH->SR & FLASH_FLAG_EOP) {
+		__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP);
+
+		Program_Address += Program_Step * sizeof(uint32_t);
+		Program_Data += Program_Step;
+		Program_Remaining -= Program_Step;
+		if(SimpleSD_SkipErasedWords() == 0) {
+			status = SIMPLESD_OK;
+		}
+		else {
+			/* Program the next word */
+			SimpleSD_ProgramNext();
+		}
+	}
+
+	if(status != SIMPLESD_PROGRAM_BUSY) {
+		CLEAR_BIT(FLASH->CR, FLASH_CR_PG | FLASH_IT_EOP | FLASH_IT_ERR);
+		SimpleSD_Statistics.ProgramTime += SimpleSD_ElapsedTime(Program_StartTime);
+		Program_Status = status;
+	}
+#endif
+}
+
+/*
+ * @brief  Returns the timing of the last firmware upgrade. Comparing ReadTime with
+ *         ProgramTime shows if the SD card or the flash is the bottleneck
+ * @param  None
+ * @retval Pointer to the statistics of the last firmware upgrade
+ */
+const SimpleSD_StatisticsTypeDef *SimpleSD_GetStatistics(void)
+{
+	return &SimpleSD_Statistics;
+}
+
+/*
+ * @brief  Enables the DWT cycle counter used for the upgrade statistics
+ * @param  None
+ * @retval None
+ */
+static void SimpleSD_TimerStart(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/*
+ * @brief  Returns the current value of the DWT cycle counter
+ * @param  None
+ * @retval Cycle counter
+ */
+static uint32_t SimpleSD_TimeStamp(void)
+{
+	return DWT->CYCCNT;
+}
+
+/*
+ * @brief  Calculates the time elapsed since a time stamp
+ * @param  Start: Time stamp taken with SimpleSD_TimeStamp()
+ * @retval Elapsed time in microseconds [intervals up to ~23 seconds at 180 MHz]
+ */
+static uint32_t SimpleSD_ElapsedTime(uint32_t Start)
+{
+	return (DWT->CYCCNT - Start) / (SystemCoreClock / 1000000);
+}
+
+/*
+ * @brief  Finds the desired Flash sector based on the input address, binary search of the geometry table
+ * @param  Address: The desired address on flash
+ * 					- APPLICATION_START_ADDRESS to APPLICATION_END_ADDRESS: Any address on the area of main application
+ * @retval sector:
+ * 					- 0 to SIMPLESD_FLASH_SECTORS-1: The flash sector [the last one for an address beyond the flash]
+ */
+uint32_t SimpleSD_FindSector(uint32_t Address)
+{
+  uint32_t first = 0, last = SIMPLESD_FLASH_SECTORS - 1, middle;
+
+  /* Last sector with a base address not above Address */
+  while(first < last) {
+    middle = (first + last + 1) / 2;
+    if(SimpleSD_FlashGeometry[middle].Base <= Address) {
+      first = middle;
+    }
+    else {
+      last = middle - 1;
+    }
   }
-  else {
-    sector = FLASH_SECTOR_23;
+  return first;
+}
+
+/*
+ * @brief  Geometry of a flash sector
+ * @param  Sector: The flash sector [0 to SIMPLESD_FLASH_SECTORS-1]
+ * @retval Pointer to the base address, size, bank and typical erase time of the sector,
+ * 		   NULL for a sector the target MCU does not have
+ */
+const SimpleSD_SectorTypeDef *SimpleSD_GetSector(uint32_t Sector)
+{
+  if(Sector >= SIMPLESD_FLASH_SECTORS) {
+    return NULL;
   }
-  return sector;
+  return &SimpleSD_FlashGeometry[Sector];
 }
 
 /*
@@ -317,15 +2403,29 @@ void SimpleSD_JumpToMainFirmware(void)
 {
 		pFunction JumpToApplication;
 		uint32_t JumpAddress;
+#if SIMPLESD_DUAL_BANK
+		/* Select the slot before the CRC peripheral is reset */
+		uint32_t Base = SimpleSD_ActiveSlot();
+#endif
+
+#if SIMPLESD_FAST_BOOT
+		/* Report the boot latency to the firmware before the HAL time base is reset */
+		SimpleSD_WriteBackup(SIMPLESD_BOOT_LATENCY_BKP, SimpleSD_BootTime());
+#endif
 
 		HAL_RCC_DeInit();
 		HAL_DeInit();
 
-		SysTick->CTRL = 0;
-		SysTick->LOAD = 0;
-		SysTick->VAL  = 0;
 		SCB->VTOR = APPLICATION_START_ADDRESS;
 
+#if SIMPLESD_DUAL_BANK
+		if(Base == SIMPLESD_SLOT_B_ADDRESS) {
+			/* Slot B runs at APPLICATION_START_ADDRESS with Bank 2 mapped at 0x08000000 */
+			__HAL_RCC_SYSCFG_CLK_ENABLE();
+			SimpleSD_JumpBankSwap(*(__IO uint32_t*)Base, *(__IO uint32_t*)(Base + 4));
+		}
+#endif
+
 		JumpAddress = *(__IO uint32_t*) (APPLICATION_START_ADDRESS + 4);
 		JumpToApplication = (pFunction) JumpAddress;
 
@@ -335,6 +2435,102 @@ void SimpleSD_JumpToMainFirmware(void)
 }
 
 
+#if SIMPLESD_FAST_BOOT || SIMPLESD_VERIFIED_STAMP || SIMPLESD_JOURNAL
+/*
+ * @brief  Writes a RTC backup register
+ * @param  Index: The backup register [0 to 19]
+ * 		   Value: The value to write
+ * @retval None
+ */
+static void SimpleSD_WriteBackup(uint32_t Index, uint32_t Value)
+{
+	__HAL_RCC_PWR_CLK_ENABLE();
+	HAL_PWR_EnableBkUpAccess();
+	SIMPLESD_BKP_REGISTER(Index) = Value;
+	HAL_PWR_DisableBkUpAccess();
+}
+#endif
+
+#if SIMPLESD_FAST_BOOT
+
+/*
+ * @brief  Jumps to the firmware if no update has been requested and its CRC is correct, returns otherwise.
+ *         Call it right after SystemClock_Config() and MX_CRC_Init(), before the SD card and FatFs are initialised
+ * @param  None
+ * @retval None
+ */
+void SimpleSD_FastBoot(void)
+{
+	if(SimpleSD_UpdateRequested()) {
+		/* Take the full path to the firmware upgrade */
+		return;
+	}
+	if(SimpleSD_BootCheck() == SIMPLESD_CRC_SAME) {
+		SimpleSD_JumpToMainFirmware();
+	}
+}
+
+/*
+ * @brief  Requests a firmware upgrade on the next reset. Called by the firmware
+ * @param  None
+ * @retval None
+ */
+void SimpleSD_RequestUpdate(void)
+{
+	SimpleSD_WriteBackup(SIMPLESD_UPDATE_REQUEST_BKP, SIMPLESD_UPDATE_REQUEST);
+}
+
+/*
+ * @brief  Checks if the firmware has requested a firmware upgrade
+ * @param  None
+ * @retval 1: Update requested
+ * 		   0: No update requested
+ */
+uint8_t SimpleSD_UpdateRequested(void)
+{
+	return (SIMPLESD_BKP_REGISTER(SIMPLESD_UPDATE_REQUEST_BKP) == SIMPLESD_UPDATE_REQUEST);
+}
+
+/*
+ * @brief  Clears the update request before the firmware upgrade starts, a failing upgrade is not repeated
+ * @param  None
+ * @retval None
+ */
+void SimpleSD_ClearUpdateRequest(void)
+{
+	SimpleSD_WriteBackup(SIMPLESD_UPDATE_REQUEST_BKP, 0);
+}
+
+/*
+ * @brief  Time the bootloader needed to start the firmware. Called by the firmware
+ * @param  None
+ * @retval Time from HAL_Init() of the bootloader to the jump, in microseconds
+ */
+uint32_t SimpleSD_BootLatency(void)
+{
+	return SIMPLESD_BKP_REGISTER(SIMPLESD_BOOT_LATENCY_BKP);
+}
+
+/*
+ * @brief  Time since HAL_Init() from the HAL tick and the counter of the time base timer, valid across clock
+ *         changes. The startup code before HAL_Init() runs on HSI and is not counted
+ * @param  None
+ * @retval Time in microseconds
+ */
+static uint32_t SimpleSD_BootTime(void)
+{
+	uint32_t ms, ticks;
+
+	/* Read again if the tick has been incremented in between */
+	do {
+		ms = HAL_GetTick();
+		ticks = SIMPLESD_TICK_TIMER->CNT;
+	} while(ms != HAL_GetTick());
+
+	return (ms * 1000) + (uint32_t)(((uint64_t)ticks * 1000 * HAL_GetTickFreq()) / (SIMPLESD_TICK_TIMER->ARR + 1));
+}
+#endif
+
 /*
  * @brief  Toggle or switch off the LED based on the LED_Reload_Value and LED_Toggle_Counter
  * @param  None
@@ -376,41 +2572,503 @@ void SimpleSD_ModeLED(uint8_t Mode)
 }
 
 /*
- * @brief  Check the CRC for internal Flash
+ * @brief  Check the CRC for internal Flash. In the dual bank layout a damaged active slot falls back
+ *         to the other slot if it has been installed and its CRC is correct, it is active from then on
  * @param  None
  * @retval enum SimpleSD_ErrorCodes:
 * 					- SIMPLESD_CRC_CORRECT       		  Calculated CRC and stored CRC are same
 *					- SIMPLESD_CRC_MISSMATCH:	 		  Calculated CRC and stored CRC are different
 */
 uint8_t SimpleSD_CRC_Check(void)
+{
+#if SIMPLESD_DUAL_BANK
+	uint32_t Other;
+#endif
+
+	if(SimpleSD_SlotCRC_Check(SimpleSD_ActiveSlot()) == SIMPLESD_CRC_SAME) {
+		return SIMPLESD_CRC_SAME;
+	}
+#if SIMPLESD_DUAL_BANK
+	Other = (Slot_Active == SIMPLESD_SLOT_A_ADDRESS) ? SIMPLESD_SLOT_B_ADDRESS : SIMPLESD_SLOT_A_ADDRESS;
+	if((SimpleSD_SlotSequence(Other) != 0) && (SimpleSD_SlotCRC_Check(Other) == SIMPLESD_CRC_SAME)) {
+		Slot_Active = Other;
+		return SIMPLESD_CRC_SAME;
+	}
+#endif
+	return SIMPLESD_CRC_ERROR;
+}
+
+/*
+ * @brief  Check of the firmware before it is started. With a valid verified stamp the CRC calculation
+ *         is skipped, except every SIMPLESD_RECHECK_BOOTS boots. Otherwise SimpleSD_CRC_Check() runs and
+ *         a correct CRC is stamped. In the dual bank layout the stamp names the slot it was written for,
+ *         a stamp of the other slot is left by a fallback from a damaged slot and boots the other slot
+ * @param  None
+ * @retval enum SimpleSD_CRC:
+ * 					- SIMPLESD_CRC_SAME       		  The firmware is intact
+ *					- SIMPLESD_CRC_ERROR:	 		  Calculated CRC and stored CRC are different
+ */
+uint8_t SimpleSD_BootCheck(void)
+{
+#if SIMPLESD_VERIFIED_STAMP
+	uint32_t boots = SIMPLESD_BKP_REGISTER(SIMPLESD_STAMP_BOOTS_BKP) + 1;
+	uint32_t stamp = SIMPLESD_BKP_REGISTER(SIMPLESD_STAMP_CHECK_BKP), Base = SimpleSD_ActiveSlot();
+#if SIMPLESD_DUAL_BANK
+	uint32_t Other = (Base == SIMPLESD_SLOT_A_ADDRESS) ? SIMPLESD_SLOT_B_ADDRESS : SIMPLESD_SLOT_A_ADDRESS;
+#endif
+#if SIMPLESD_BLOCK_CRC
+	uint32_t count, offset;
+#endif
+
+#if SIMPLESD_DUAL_BANK
+	if((stamp != SimpleSD_StampValue(Base)) && (SimpleSD_SlotSequence(Other) != 0) &&
+	   (stamp == SimpleSD_StampValue(Other))) {
+		Slot_Active = Base = Other;
+	}
+#endif
+	if((stamp == SimpleSD_StampValue(Base)) &&
+	   ((SIMPLESD_RECHECK_BOOTS == 0) || (boots < SIMPLESD_RECHECK_BOOTS))) {
+#if SIMPLESD_BLOCK_CRC
+		/* Background check of one block per boot, a damaged block falls back to the full CRC calculation */
+		count = SimpleSD_BlockCount((const uint32_t *)Base, SimpleSD_SlotImageSize(Base));
+		offset = ((const uint32_t *)Base)[SIMPLESD_IMAGE_BLOCKS_OFFSET / 4];
+		if((count == 0) || (SimpleSD_BlockCheck(Base, offset, (const uint32_t *)(Base + offset), boots % count) == SIMPLESD_CRC_SAME))
+#endif
+		{
+			SimpleSD_WriteBackup(SIMPLESD_STAMP_BOOTS_BKP, boots);
+			return SIMPLESD_CRC_SAME;
+		}
+	}
+#endif
+	if(SimpleSD_CRC_Check() != SIMPLESD_CRC_SAME) {
+		return SIMPLESD_CRC_ERROR;
+	}
+#if SIMPLESD_VERIFIED_STAMP
+	SimpleSD_StampWrite();
+#endif
+	return SIMPLESD_CRC_SAME;
+}
+
+#if SIMPLESD_VERIFIED_STAMP
+/* Mixed into the stamp, so cleared or random backup registers do not form a valid stamp */
+#define SIMPLESD_STAMP_MAGIC ((uint32_t)0x5354414D)
+
+/*
+ * @brief  Stamp of the firmware in a slot: its CRC word combined with the slot address and the flash
+ *         write generation
+ * @param  Base: Flash address of the slot
+ * @retval The value the stamp register holds while the stamp is valid
+ */
+static uint32_t SimpleSD_StampValue(uint32_t Base)
+{
+	return SIMPLESD_STAMP_MAGIC ^ *(__IO uint32_t*)(Base + SimpleSD_SlotImageSize(Base)) ^ Base ^
+		   SIMPLESD_BKP_REGISTER(SIMPLESD_GENERATION_BKP);
+}
+
+/*
+ * @brief  Stamps the installed firmware as verified
+ * @param  None
+ * @retval None
+ */
+static void SimpleSD_StampWrite(void)
+{
+	SimpleSD_WriteBackup(SIMPLESD_STAMP_CHECK_BKP, SimpleSD_StampValue(SimpleSD_ActiveSlot()));
+	SimpleSD_WriteBackup(SIMPLESD_STAMP_BOOTS_BKP, 0);
+}
+
+/*
+ * @brief  Increments the flash write generation, which invalidates the stamp. Called before the flash
+ *         is modified, so an interrupted upgrade is checked with a full CRC calculation
+ * @param  None
+ * @retval None
+ */
+static void SimpleSD_StampInvalidate(void)
+{
+	SimpleSD_WriteBackup(SIMPLESD_GENERATION_BKP, SIMPLESD_BKP_REGISTER(SIMPLESD_GENERATION_BKP) + 1);
+}
+#endif
+
+/*
+ * @brief  Check the CRC of the image in a slot
+ * @param  Base: Flash address of the slot
+ * @retval enum SimpleSD_ErrorCodes:
+* 					- SIMPLESD_CRC_CORRECT       		  Calculated CRC and stored CRC are same
+*					- SIMPLESD_CRC_MISSMATCH:	 		  Calculated CRC and stored CRC are different
+*/
+static uint8_t SimpleSD_SlotCRC_Check(uint32_t Base)
 {
 	uint8_t result;
-	uint32_t calculated_crc = 0xFFFFFFFF,flash_crc = 0x00000000, address, count_crc;
+	uint32_t calculated_crc = 0xFFFFFFFF,flash_crc = 0x00000000, image_size;
 
-	/* CRC Calculation using peripheral or software:
+	/* CRC Calculation using peripheral, DMA fed peripheral or software, over the size of the installed image:
 	 * Tested on STM32F429 running on 180 MHz with 1.9MBytes bin file
-	 * 			- Peripheral: ~1mSec
-	 * 			- Software function: ~2450 mSec
+	 * 			- Software function: ~2450 mSec with the bitwise loop of CalculateCRC_32(), the slicing
+	 * 			  tables process 4 or 8 bytes per step instead of 1 bit
+	 * 			- Peripheral and DMA: not measured yet, SimpleSD_CRC_Benchmark() times both on the target
 	 */
 	result = SIMPLESD_CRC_SAME;
-	flash_crc = *(uint32_t*)APPLICATION_CRC_ADDRESS;
+	image_size = SimpleSD_SlotImageSize(Base);
+	/* The CRC follows the image */
+	flash_crc = *(uint32_t*)(Base + image_size);
+	calculated_crc = SimpleSD_CRC_Update(calculated_crc, (const uint32_t *)Base, image_size / 4);
+	if(calculated_crc != flash_crc) {
+		result = SIMPLESD_CRC_ERROR;
+	}
+	return result;
+}
+
+
+/*
+ * @brief  Finds the slot holding the firmware to boot. No CRC is calculated, a damaged slot is left
+ *         by SimpleSD_CRC_Check() [or SimpleSD_BootCheck()]
+ * @param  None
+ * @retval Flash address of the slot:
+ * 					- APPLICATION_START_ADDRESS: Single bank layout
+ * 					- SIMPLESD_SLOT_A_ADDRESS or SIMPLESD_SLOT_B_ADDRESS: Slot with the newest sequence number,
+ * 					  slot A if none of them has one
+ */
+uint32_t SimpleSD_ActiveSlot(void)
+{
+#if SIMPLESD_DUAL_BANK
+	if(Slot_Active == 0) {
+		Slot_Active = SimpleSD_SequenceNewer(SimpleSD_SlotSequence(SIMPLESD_SLOT_B_ADDRESS),
+											 SimpleSD_SlotSequence(SIMPLESD_SLOT_A_ADDRESS)) ?
+					  SIMPLESD_SLOT_B_ADDRESS : SIMPLESD_SLOT_A_ADDRESS;
+	}
+	return Slot_Active;
+#else
+	return APPLICATION_START_ADDRESS;
+#endif
+}
+
+#if SIMPLESD_DUAL_BANK
+/*
+ * @brief  Reads the sequence number programmed after the image of a slot
+ * @param  Base: Flash address of the slot
+ * @retval Sequence number, 0 if the slot has none or its vector table is not sane
+ */
+static uint32_t SimpleSD_SlotSequence(uint32_t Base)
+{
+	const uint32_t *Vectors = (const uint32_t *)Base;
+	uint32_t sequence, size = SimpleSD_SlotImageSize(Base);
+
+	/* A legacy image leaves no room for the record */
+	if(size + APPLICATION_CRC_SIZE + SIMPLESD_SLOT_RECORD_SIZE > SIMPLESD_SLOT_SIZE) {
+		return 0;
+	}
+	/* Stack pointer in SRAM and reset handler in the image, linked at APPLICATION_START_ADDRESS */
+	if(((Vectors[0] & 0x2FF00000) != 0x20000000) ||
+	   (Vectors[1] < APPLICATION_START_ADDRESS) || (Vectors[1] >= APPLICATION_START_ADDRESS + size)) {
+		return 0;
+	}
+	sequence = *(uint32_t*)(Base + size + APPLICATION_CRC_SIZE);
+	if(sequence == 0xFFFFFFFF) {
+		return 0;
+	}
+	return sequence;
+}
+
+/*
+ * @brief  Compares the sequence numbers of the slots, the numbers wrap around
+ * @param  Sequence: Sequence number of a slot, 0 if it has none
+ * 		   Other: Sequence number of the other slot, 0 if it has none
+ * @retval 1: Sequence is newer than Other
+ * 		   0: Sequence is not newer than Other
+ */
+static uint8_t SimpleSD_SequenceNewer(uint32_t Sequence, uint32_t Other)
+{
+	return (Sequence != 0) && ((Other == 0) || ((int32_t)(Sequence - Other) > 0));
+}
+
+/*
+ * @brief  Sequence number of the slot installed next
+ * @param  Sequence: Sequence number of the active slot, 0 if it has none
+ * @retval Next sequence number, 0 and the erased value 0xFFFFFFFF are skipped
+ */
+static uint32_t SimpleSD_SequenceNext(uint32_t Sequence)
+{
+	Sequence++;
+	if((Sequence == 0) || (Sequence == 0xFFFFFFFF)) {
+		Sequence = 1;
+	}
+	return Sequence;
+}
+
+/*
+ * @brief  Maps Bank 2 at 0x08000000 [SYSCFG UFB_MODE] and starts the firmware of slot B at
+ *         APPLICATION_START_ADDRESS. Runs from RAM: once the banks are swapped the bootloader
+ *         is no longer at its address
+ * @param  StackPointer: Initial stack pointer of the firmware
+ * 		   ResetHandler: Reset handler of the firmware
+ * @retval None
+ */
+__attribute__((section(".RamFunc"), noinline, long_call))
+static void SimpleSD_JumpBankSwap(uint32_t StackPointer, uint32_t ResetHandler)
+{
+	SYSCFG->MEMRMP |= SYSCFG_MEMRMP_UFB_MODE;
+	__DSB();
+	__ISB();
+
+	/* Initialize user application's Stack Pointer */
+	__set_MSP(StackPointer);
+	((pFunction)ResetHandler)();
+}
+#endif
+
+/*
+ * @brief  Size of the installed image, the CRC is stored right after it
+ * @param  None
+ * @retval Size in bytes:
+ * 					- Size declared by a SimpleSD image
+ * 					- APPLICATION_CRC_CALCULATION_SIZE*4 for a legacy image filling the application area
+ */
+uint32_t SimpleSD_ImageSize(void)
+{
+	return SimpleSD_SlotImageSize(SimpleSD_ActiveSlot());
+}
+
+/*
+ * @brief  Size of the image in a slot, the CRC is stored right after it
+ * @param  Base: Flash address of the slot
+ * @retval Size in bytes:
+ * 					- Size declared by a SimpleSD image
+ * 					- APPLICATION_CRC_CALCULATION_SIZE*4 for a legacy image filling the slot
+ */
+static uint32_t SimpleSD_SlotImageSize(uint32_t Base)
+{
+	uint32_t size = SimpleSD_ImageSizeFromHeader((const uint32_t *)Base);
+
+	if(size == 0) {
+		/* Legacy image, the CRC is stored at APPLICATION_CRC_ADDRESS */
+		size = APPLICATION_CRC_CALCULATION_SIZE * 4;
+	}
+	return size;
+}
+
+/*
+ * @brief  Reads the image size declared in the vector table of a SimpleSD image
+ * @param  Header: The first SIMPLESD_IMAGE_HEADER_SIZE bytes of the image
+ * @retval Size in bytes:
+ * 					- 0: Not a SimpleSD image or invalid size
+ * 					- Size of the image without its CRC
+ */
+uint32_t SimpleSD_ImageSizeFromHeader(const uint32_t *Header)
+{
+	uint32_t size = Header[SIMPLESD_IMAGE_SIZE_OFFSET / 4];
+
+	if((Header[SIMPLESD_IMAGE_MAGIC_OFFSET / 4] != SIMPLESD_IMAGE_MAGIC) || (size < SIMPLESD_IMAGE_HEADER_SIZE) ||
+	   (size > APPLICATION_MAX_SIZE - APPLICATION_CRC_SIZE - SIMPLESD_SLOT_RECORD_SIZE) || (size % sizeof(uint32_t))) {
+		return 0;
+	}
+	return size;
+}
+
+/*
+ * @brief  Continues a CRC calculation with a block of words, using the method of CRC_CALCULATION_METHOD.
+ *         The CRC of a stream of blocks is calculated block by block:
+ *         	crc = 0xFFFFFFFF; crc = SimpleSD_CRC_Update(crc, block, words); ...
+ * @param  Crc: CRC of the previous blocks, 0xFFFFFFFF for the first block
+ * 		   Data: The words of the block
+ * 		   Words: Number of words in the block
+ * @retval CRC including the block
+ */
+uint32_t SimpleSD_CRC_Update(uint32_t Crc, const uint32_t *Data, uint32_t Words)
+{
 #if CRC_CALCULATION_METHOD
-	calculated_crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)APPLICATION_START_ADDRESS, 16);
+#if CRC_CALCULATION_METHOD == CRC_USING_DMA
+	uint32_t Result;
+#endif
+
+	if(Words == 0) {
+		return Crc;
+	}
+	/* The peripheral keeps the CRC in its data register. If it has been used for something else, set it again */
+	if(hcrc.Instance->DR != Crc) {
+		SimpleSD_CRC_Seed(Crc);
+	}
+#if CRC_CALCULATION_METHOD == CRC_USING_DMA
+	if(SimpleSD_CRC_DMA(Data, Words, &Result) == HAL_OK) {
+		return Result;
+	}
+	/* DMA error: part of the block may have been fed, the CPU feeds the whole block again */
+	SimpleSD_CRC_Seed(Crc);
+#endif
+	return HAL_CRC_Accumulate(&hcrc, (uint32_t *)Data, Words);
 #else
-	address   = APPLICATION_START_ADDRESS;
-	count_crc = APPLICATION_CRC_CALCULATION_SIZE;
-	while (count_crc--)
+	uint32_t c;
+#if SIMPLESD_CRC_SLICES == 8
+	uint32_t w;
+#endif
+
+#if SIMPLESD_CRC_TABLE_LOCATION != SIMPLESD_CRC_TABLE_FLASH
+	if(!SimpleSD_CRC_TableReady) {
+		SimpleSD_CRC_TableInit();
+	}
+#endif
+	/* The CRC is linear: the 32 shifts of CalculateCRC_32() on a word are the sum of the
+	 * shifts of its 4 bytes, looked up in the table holding the matching number of shifts */
+#if SIMPLESD_CRC_SLICES == 8
+	while (Words >= 2)
 	{
-		calculated_crc = CalculateCRC_32(calculated_crc, *(uint32_t*)address);
-		address += 4;
+		c = Crc ^ Data[0];
+		w = Data[1];
+		Crc = SimpleSD_CRC_Table[7][c >> 24] ^ SimpleSD_CRC_Table[6][(c >> 16) & 0xFF] ^
+			  SimpleSD_CRC_Table[5][(c >> 8) & 0xFF] ^ SimpleSD_CRC_Table[4][c & 0xFF] ^
+			  SimpleSD_CRC_Table[3][w >> 24] ^ SimpleSD_CRC_Table[2][(w >> 16) & 0xFF] ^
+			  SimpleSD_CRC_Table[1][(w >> 8) & 0xFF] ^ SimpleSD_CRC_Table[0][w & 0xFF];
+		Data += 2;
+		Words -= 2;
 	}
 #endif
-	if(calculated_crc != flash_crc) {
-		result = SIMPLESD_CRC_ERROR;
+	while (Words--)
+	{
+		c = Crc ^ *Data++;
+		Crc = SimpleSD_CRC_Table[3][c >> 24] ^ SimpleSD_CRC_Table[2][(c >> 16) & 0xFF] ^
+			  SimpleSD_CRC_Table[1][(c >> 8) & 0xFF] ^ SimpleSD_CRC_Table[0][c & 0xFF];
 	}
-	return result;
+	return Crc;
+#endif
+}
+
+#if (CRC_CALCULATION_METHOD == CRC_USING_FUNCTION) && (SIMPLESD_CRC_TABLE_LOCATION != SIMPLESD_CRC_TABLE_FLASH)
+/*
+ * @brief  Builds the slicing tables of the software CRC for CRC_POLYNOMIAL.
+ *         Table k holds the CRC register after 8*(k+1) shifts of a byte placed in the top byte
+ * @param  None
+ * @retval None
+ */
+static void SimpleSD_CRC_TableInit(void)
+{
+	uint32_t crc;
+
+	for(uint32_t i=0; i < 256; i++) {
+		crc = i << 24;
+		for(uint8_t bit=0; bit < 8; bit++) {
+			crc = (crc & 0x80000000) ? ((crc << 1) ^ CRC_POLYNOMIAL) : (crc << 1);
+		}
+		SimpleSD_CRC_Table[0][i] = crc;
+	}
+	for(uint32_t k=1; k < SIMPLESD_CRC_SLICES; k++) {
+		for(uint32_t i=0; i < 256; i++) {
+			crc = SimpleSD_CRC_Table[k-1][i];
+			SimpleSD_CRC_Table[k][i] = (crc << 8) ^ SimpleSD_CRC_Table[0][crc >> 24];
+		}
+	}
+	SimpleSD_CRC_TableReady = 1;
+}
+#endif
+
+#if CRC_CALCULATION_METHOD
+/*
+ * @brief  Sets the CRC peripheral to a CRC: resets it and feeds the word that brings it from 0xFFFFFFFF to Crc
+ * @param  Crc: CRC of the previous blocks, 0xFFFFFFFF for the first block
+ * @retval None
+ */
+static void SimpleSD_CRC_Seed(uint32_t Crc)
+{
+	uint32_t seed;
+
+	__HAL_CRC_DR_RESET(&hcrc);
+	if(Crc != 0xFFFFFFFF) {
+		/* Undo the 32 shifts of CalculateCRC_32() */
+		seed = Crc;
+		for(uint8_t i=0; i < 32; i++) {
+			if(seed & 0x00000001) {
+				seed = ((seed ^ STM32_POLYNOMIAL) >> 1) | 0x80000000;
+			}
+			else {
+				seed = (seed >> 1);
+			}
+		}
+		hcrc.Instance->DR = seed ^ 0xFFFFFFFF;
+	}
+}
+
+/*
+ * @brief  Feeds a block of words to the CRC peripheral with DMA2 memory-to-memory transfers.
+ *         The words are moved from flash or SRAM to CRC->DR at bus speed, without the CPU
+ *         loading and storing every word. CCMRAM is not reachable by the DMA
+ * @param  Data: The words of the block
+ * 		   Words: Number of words in the block
+ * 		   Crc: Set to the content of the CRC data register once the block has been fed
+ * @retval HAL_OK, HAL_ERROR or HAL_TIMEOUT: the DMA failed, the peripheral holds part of the block
+ */
+static HAL_StatusTypeDef SimpleSD_CRC_DMA(const uint32_t *Data, uint32_t Words, uint32_t *Crc)
+{
+	HAL_StatusTypeDef status;
+	uint32_t length;
+
+	if(SimpleSD_hdma_crc.Instance == NULL) {
+		__HAL_RCC_DMA2_CLK_ENABLE();
+		/* Memory-to-memory: the "peripheral" side is the incremented source, the memory side is the fixed CRC->DR */
+		SimpleSD_hdma_crc.Instance = SIMPLESD_CRC_DMA_STREAM;
+		SimpleSD_hdma_crc.Init.Channel = SIMPLESD_CRC_DMA_CHANNEL;
+		SimpleSD_hdma_crc.Init.Direction = DMA_MEMORY_TO_MEMORY;
+		SimpleSD_hdma_crc.Init.PeriphInc = DMA_PINC_ENABLE;
+		SimpleSD_hdma_crc.Init.MemInc = DMA_MINC_DISABLE;
+		SimpleSD_hdma_crc.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+		SimpleSD_hdma_crc.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+		SimpleSD_hdma_crc.Init.Mode = DMA_NORMAL;
+		SimpleSD_hdma_crc.Init.Priority = DMA_PRIORITY_LOW;
+		SimpleSD_hdma_crc.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+		SimpleSD_hdma_crc.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+		SimpleSD_hdma_crc.Init.MemBurst = DMA_MBURST_SINGLE;
+		SimpleSD_hdma_crc.Init.PeriphBurst = DMA_PBURST_SINGLE;
+		if(HAL_DMA_Init(&SimpleSD_hdma_crc) != HAL_OK) {
+			SimpleSD_hdma_crc.Instance = NULL;
+			return HAL_ERROR;
+		}
+	}
+
+	/* A transfer moves up to 65535 items */
+	while(Words) {
+		length = (Words > 0xFFFF) ? 0xFFFF : Words;
+		status = HAL_DMA_Start(&SimpleSD_hdma_crc, (uint32_t)Data, (uint32_t)&hcrc.Instance->DR, length);
+		if(status == HAL_OK) {
+			status = HAL_DMA_PollForTransfer(&SimpleSD_hdma_crc, HAL_DMA_FULL_TRANSFER, SIMPLESD_CRC_DMA_TIMEOUT);
+		}
+		if(status != HAL_OK) {
+			HAL_DMA_Abort(&SimpleSD_hdma_crc);
+			return status;
+		}
+#if SD_WATCHDOG_RUNNING
+		HAL_IWDG_Refresh(&hiwdg);
+#endif
+		Data += length;
+		Words -= length;
+	}
+	*Crc = hcrc.Instance->DR;
+	return HAL_OK;
 }
 
+/*
+ * @brief  Measures the CRC calculation of the installed image with the CRC peripheral fed by
+ *         the CPU [HAL_CRC_Calculate()] and fed by DMA2
+ * @param  Result: Timing and CRC of both methods
+ * @retval None
+ */
+void SimpleSD_CRC_Benchmark(SimpleSD_CRCBenchmarkTypeDef *Result)
+{
+	uint32_t StartTime, Base;
+
+	SimpleSD_TimerStart();
+	Base = SimpleSD_ActiveSlot();
+	Result->Words = SimpleSD_SlotImageSize(Base) / 4;
+
+	StartTime = SimpleSD_TimeStamp();
+	Result->HALCRC = HAL_CRC_Calculate(&hcrc, (uint32_t *)Base, Result->Words);
+	Result->HALTime = SimpleSD_ElapsedTime(StartTime);
+
+#if SD_WATCHDOG_RUNNING
+	HAL_IWDG_Refresh(&hiwdg);
+#endif
+
+	StartTime = SimpleSD_TimeStamp();
+	__HAL_CRC_DR_RESET(&hcrc);
+	Result->DMAStatus = SimpleSD_CRC_DMA((const uint32_t *)Base, Result->Words, &Result->DMACRC);
+	Result->DMATime = SimpleSD_ElapsedTime(StartTime);
+}
+#endif
 
 /*
  * @brief  Calculate CRC based on defined polynomial
@@ -424,6 +3082,10 @@ uint8_t SimpleSD_CRC_Check(void)
 */
 uint32_t CalculateCRC_32(uint32_t crc, uint32_t data)
 {
+#if CRC_CALCULATION_METHOD == CRC_USING_FUNCTION
+  /* Table driven, bit-exact with the loop below */
+  return SimpleSD_CRC_Update(crc, &data, 1);
+#else
   crc = crc ^ data;
   for(uint8_t i=0; i < 32; i++) {
     if (crc & 0x80000000) {
@@ -434,4 +3096,5 @@ uint32_t CalculateCRC_32(uint32_t crc, uint32_t data)
     }
   }
   return(crc);
+#endif
 }
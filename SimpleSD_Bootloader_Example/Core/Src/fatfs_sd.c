@@ -20,6 +20,15 @@ static volatile DSTATUS Stat = STA_NOINIT;              /* Disc Status Flag*/
 static uint8_t CardType;                                /* SD type 0:MMC, 1:SDC, 2:Block addressing */
 static uint8_t PowerFlag = 0;                           /* Power condition Flag */
 
+#if SD_SPI_USE_DMA
+#define SPI_DMA_BUSY  0
+#define SPI_DMA_DONE  1
+#define SPI_DMA_ERROR 2
+
+static volatile uint8_t SPI_DmaStatus;                  /* DMA transfer status, set from the SPI callbacks */
+static uint8_t SPI_DummyByte = 0xFF;                    /* Transmitted for every received byte */
+#endif
+
 
 /* SPI Chip Select */
 static void SELECT(void)
@@ -33,32 +42,142 @@ static void DESELECT(void)
   HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_SET);
 }
 
+#if SD_SPI_BACKEND == SD_SPI_BACKEND_REGISTER
+/* SPI enable, the register backend does not go through the HAL which enables the SPI on first use */
+static void SPI_Enable(void)
+{
+  __HAL_SPI_ENABLE(&hspi4);
+}
+
+/* SPI Data send / receive of one byte through the data register */
+static inline uint8_t SPI_Exchange(uint8_t data)
+{
+  SPI_TypeDef *spi = hspi4.Instance;
+
+  while (!(spi->SR & SPI_SR_TXE));
+  *(__IO uint8_t *)&spi->DR = data;
+  while (!(spi->SR & SPI_SR_RXNE));
+  
+  return *(__IO uint8_t *)&spi->DR;
+}
+
+/* SPI bulk transmit, received bytes are discarded */
+static void SPI_TxBuffer(const uint8_t *buff, UINT len)
+{
+  while (len--)
+  {
+    SPI_Exchange(*buff++);
+  }
+}
+#else
+/* SPI enable, done by the HAL on the first transfer */
+static void SPI_Enable(void)
+{
+}
+
+/* SPI Data send / receive of one byte */
+static uint8_t SPI_Exchange(uint8_t data)
+{
+  uint8_t rx = 0;
+  
+  while ((HAL_SPI_GetState(&hspi4) != HAL_SPI_STATE_READY));
+  HAL_SPI_TransmitReceive(&hspi4, &data, &rx, 1, SPI_TIMEOUT);
+  
+  return rx;
+}
+
+/* SPI bulk transmit */
+static void SPI_TxBuffer(const uint8_t *buff, UINT len)
+{
+  while (HAL_SPI_GetState(&hspi4) != HAL_SPI_STATE_READY);
+  HAL_SPI_Transmit(&hspi4, (uint8_t *)buff, len, SPI_TIMEOUT);
+}
+#endif /* SD_SPI_BACKEND */
+
+/* SPI bulk receive, 0xFF is sent for every received byte */
+static void SPI_RxBuffer(uint8_t *buff, UINT len)
+{
+  while (len--)
+  {
+    *buff++ = SPI_Exchange(0xFF);
+  }
+}
+
 /* SPI Transmit*/
 static void SPI_TxByte(BYTE data)
 {
-  while (HAL_SPI_GetState(&hspi4) != HAL_SPI_STATE_READY);
-  HAL_SPI_Transmit(&hspi4, &data, 1, SPI_TIMEOUT);
+  SPI_Exchange(data);
 }
 
 /* SPI Data send / receive return type function */
 static uint8_t SPI_RxByte(void)
 {
-  uint8_t dummy, data;
-  dummy = 0xFF;
-  data = 0;
-  
-  while ((HAL_SPI_GetState(&hspi4) != HAL_SPI_STATE_READY));
-  HAL_SPI_TransmitReceive(&hspi4, &dummy, &data, 1, SPI_TIMEOUT);
-  
-  return data;
+  return SPI_Exchange(0xFF);
 }
 
-/* SPI Data send / receive pointer type function*/
-static void SPI_RxBytePtr(uint8_t *buff) 
+#if SD_SPI_USE_DMA
+/* Wait for the end of the DMA transfer, signalled from the SPI callbacks */
+static bool SPI_WaitDMA(void)
 {
-  *buff = SPI_RxByte();
+  Timer1 = SD_DMA_TIMEOUT;
+
+  while (SPI_DmaStatus == SPI_DMA_BUSY)
+  {
+    if (Timer1 == 0)
+    {
+      HAL_SPI_Abort(&hspi4);
+      return FALSE;
+    }
+  }
+
+  return (SPI_DmaStatus == SPI_DMA_DONE) ? TRUE : FALSE;
+}
+
+/* SPI DMA block receive, 0xFF is clocked out for every received byte */
+static bool SPI_RxBufferDMA(BYTE *buff, UINT btr)
+{
+  /* The TX stream repeats the dummy byte instead of walking through memory */
+  CLEAR_BIT(hspi4.hdmatx->Instance->CR, DMA_SxCR_MINC);
+
+  SPI_DmaStatus = SPI_DMA_BUSY;
+  if (HAL_SPI_TransmitReceive_DMA(&hspi4, &SPI_DummyByte, buff, btr) != HAL_OK)
+    return FALSE;
+
+  return SPI_WaitDMA();
+}
+
+/* SPI DMA block transmit */
+static bool SPI_TxBufferDMA(const BYTE *buff, UINT btt)
+{
+  SET_BIT(hspi4.hdmatx->Instance->CR, DMA_SxCR_MINC);
+
+  SPI_DmaStatus = SPI_DMA_BUSY;
+  if (HAL_SPI_Transmit_DMA(&hspi4, (uint8_t *)buff, btt) != HAL_OK)
+    return FALSE;
+
+  return SPI_WaitDMA();
 }
 
+/* SPI DMA callbacks */
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  if (hspi->Instance == hspi4.Instance)
+    SPI_DmaStatus = SPI_DMA_DONE;
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  if (hspi->Instance == hspi4.Instance)
+    SPI_DmaStatus = SPI_DMA_DONE;
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+  if (hspi->Instance == hspi4.Instance)
+    SPI_DmaStatus = SPI_DMA_ERROR;
+}
+#endif /* SD_SPI_USE_DMA */
+
 /* SD CARD Ready wait */
 static uint8_t SD_ReadyWait(void) 
 {
@@ -85,6 +204,7 @@ static void SD_PowerOn(void)
   uint32_t Count = 0x1FFF;
   
 
+  SPI_Enable();
   DESELECT();
   
   for(int i = 0; i < 10; i++)
@@ -104,10 +224,7 @@ static void SD_PowerOn(void)
   cmd_arg[5] = 0x95;
   
   /* Command transmission*/
-  for (int i = 0; i < 6; i++)
-  {
-    SPI_TxByte(cmd_arg[i]);
-  }
+  SPI_TxBuffer(cmd_arg, 6);
   
   /* Answer waiting*/
   while ((SPI_RxByte() != 0x01) && Count)
@@ -153,11 +270,17 @@ static bool SD_RxDataBlock(BYTE *buff, UINT btr)
     return FALSE;
   
   /* 버퍼에 데이터 수신 */
-  do 
-  {     
-    SPI_RxBytePtr(buff++);
-    SPI_RxBytePtr(buff++);
-  } while(btr -= 2);
+#if SD_SPI_USE_DMA
+  if (btr >= SD_DMA_MIN_SIZE)
+  {
+    if (!SPI_RxBufferDMA(buff, btr))
+      return FALSE;
+  }
+  else
+#endif
+  {
+    SPI_RxBuffer(buff, btr);
+  }
   
   SPI_RxByte(); /* CRC 무시 */
   SPI_RxByte();
@@ -169,7 +292,7 @@ static bool SD_RxDataBlock(BYTE *buff, UINT btr)
 #if _READONLY == 0
 static bool SD_TxDataBlock(const BYTE *buff, BYTE token)
 {
-  uint8_t resp, wc;
+  uint8_t resp;
   uint8_t i = 0;
     
   /* SD카드 준비 대기 */
@@ -182,14 +305,13 @@ static bool SD_TxDataBlock(const BYTE *buff, BYTE token)
   /* 데이터 토큰인 경우 */
   if (token != 0xFD) 
   { 
-    wc = 0;
-    
     /* 512 바이트 데이터 전송 */
-    do 
-    { 
-      SPI_TxByte(*buff++);
-      SPI_TxByte(*buff++);
-    } while (--wc);
+#if SD_SPI_USE_DMA
+    if (!SPI_TxBufferDMA(buff, 512))
+      return FALSE;
+#else
+    SPI_TxBuffer(buff, 512);
+#endif
     
     SPI_RxByte();       /* CRC 무시 */
     SPI_RxByte();
@@ -220,19 +342,12 @@ static bool SD_TxDataBlock(const BYTE *buff, BYTE token)
 /* CMD 패킷 전송 */
 static BYTE SD_SendCmd(BYTE cmd, DWORD arg) 
 {
-  uint8_t crc, res;
+  uint8_t crc, res, packet[6];
   
   /* SD카드 대기 */
   if (SD_ReadyWait() != 0xFF)
     return 0xFF;
   
-  /* 명령 패킷 전송 */
-  SPI_TxByte(cmd); 			/* Command */
-  SPI_TxByte((BYTE) (arg >> 24)); 	/* Argument[31..24] */
-  SPI_TxByte((BYTE) (arg >> 16)); 	/* Argument[23..16] */
-  SPI_TxByte((BYTE) (arg >> 8)); 	/* Argument[15..8] */
-  SPI_TxByte((BYTE) arg); 		/* Argument[7..0] */
-  
   /* 명령별 CRC 준비 */
   crc = 0;  
   if (cmd == CMD0)
@@ -241,8 +356,14 @@ static BYTE SD_SendCmd(BYTE cmd, DWORD arg)
   if (cmd == CMD8)
     crc = 0x87; /* CRC for CMD8(0x1AA) */
   
-  /* CRC 전송 */
-  SPI_TxByte(crc);
+  /* 명령 패킷 전송 */
+  packet[0] = cmd; 			/* Command */
+  packet[1] = (BYTE) (arg >> 24); 	/* Argument[31..24] */
+  packet[2] = (BYTE) (arg >> 16); 	/* Argument[23..16] */
+  packet[3] = (BYTE) (arg >> 8); 	/* Argument[15..8] */
+  packet[4] = (BYTE) arg; 		/* Argument[7..0] */
+  packet[5] = crc;			/* CRC */
+  SPI_TxBuffer(packet, 6);
   
   /* CMD12 Stop Reading 명령인 경우에는 응답 바이트 하나를 버린다 */
   if (cmd == CMD12)
@@ -55,7 +55,8 @@ SPI_HandleTypeDef hspi5;
 TIM_HandleTypeDef htim10;
 
 /* USER CODE BEGIN PV */
-
+DMA_HandleTypeDef hdma_spi4_rx;
+DMA_HandleTypeDef hdma_spi4_tx;
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -67,7 +68,7 @@ static void MX_SPI5_Init(void);
 static void MX_TIM10_Init(void);
 static void MX_IWDG_Init(void);
 /* USER CODE BEGIN PFP */
-
+static uint8_t Bootloader_Trigger(void);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -75,6 +76,7 @@ static void MX_IWDG_Init(void);
 
 void SDTimer_Handler(void);
 uint8_t UpgradeFirmware = 0;
+uint8_t UpgradeStatus;
 uint16_t WaitingTrigger;
 __IO uint8_t Timer1, Timer2;
 /* USER CODE END 0 */
@@ -102,12 +104,24 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+#if SIMPLESD_FAST_BOOT
+  /* No update requested by the firmware and no trigger at reset: jump to it if its CRC is correct.
+   * The trigger wait below is skipped by the fast boot, only a trigger present at reset is seen */
+  MX_CRC_Init();
+  if(Bootloader_Trigger()) {
+	  UpgradeFirmware = 1;
+  }
+  else {
+	  SimpleSD_FastBoot();
+  }
+#endif
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+#if !SIMPLESD_FAST_BOOT
   MX_CRC_Init();
+#endif
   MX_SPI4_Init();
   MX_SPI5_Init();
   MX_TIM10_Init();
@@ -118,30 +132,40 @@ int main(void)
   HAL_Delay(200);
 
 
+#if SIMPLESD_FAST_BOOT
+  /* Update requested by the firmware. It is cleared before the upgrade, so an upgrade failing on
+   * every attempt [no SD card, no file] is not started again after each reset */
+  if(SimpleSD_UpdateRequested()) {
+	  SimpleSD_ClearUpdateRequest();
+	  UpgradeFirmware = 1;
+  }
+#endif
+
   /* Wait until trigger to start firmware upgrade comes */
   WaitingTrigger = BOOTLOADER_TRIGGER_TIME;
   while(WaitingTrigger != 0) {
 #if SD_WATCHDOG_RUNNING
 	  HAL_IWDG_Refresh(&hiwdg);
 #endif
-	  /* Trigger to start upgrade. Could be a Button, a UART packet etc */
-	  if(0) {
+	  if(Bootloader_Trigger()) {
 		  UpgradeFirmware = 1;
 	  }
   }
 
   /* Check if firmware upgrade pending */
   if(UpgradeFirmware) {
-	  /* Start firmware upgrade and jump to main application in case of success */
-	  if(SimpleSD_FirmwareUpgrade() == SIMPLESD_OK) {
+	  /* Start firmware upgrade and jump to main application in case of success or
+	   * if the firmware on the SD card is already installed */
+	  UpgradeStatus = SimpleSD_FirmwareUpgrade();
+	  if((UpgradeStatus == SIMPLESD_OK) || (UpgradeStatus == SIMPLESD_FIRMWARE_UP_TO_DATE)) {
 	  		  SimpleSD_JumpToMainFirmware();
 	  }
   }
-  else {
-	  /* No trigger for firmware upgrade, jump to main application if CRC is correct */
-	  if(SimpleSD_CRC_Check() == SIMPLESD_CRC_SAME) {
-	  	  SimpleSD_JumpToMainFirmware();
-	    }
+
+  /* No trigger for firmware upgrade or the upgrade failed [no SD card, no file etc], jump to main application
+   * if CRC is correct [or stamped as verified]. A firmware left partly programmed fails the check */
+  if(SimpleSD_BootCheck() == SIMPLESD_CRC_SAME) {
+  	  SimpleSD_JumpToMainFirmware();
   }
 
   /* Toggle LED with 0.5Hz frequency*/
@@ -533,6 +557,18 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+/*
+ * @brief  Trigger to start upgrade. Could be a Button, a UART packet etc.
+ *         With SIMPLESD_FAST_BOOT it is also checked before MX_GPIO_Init()
+ * @param  None
+ * @retval 1: Start the firmware upgrade
+ * 		   0: No trigger
+ */
+static uint8_t Bootloader_Trigger(void)
+{
+  return 0;
+}
+
 void SDTimer_Handler(void)
 {
   if(Timer1 > 0) {
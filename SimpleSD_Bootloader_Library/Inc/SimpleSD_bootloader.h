@@ -19,7 +19,10 @@
 extern "C" {
 #endif
 
-/* Define the target MCU */
+/* Define the target MCU, it selects the flash geometry:
+ * STM32F429 [F427/F429/F437/F439, 2 Mbytes dual bank], STM32F407 [F405/F407/F415/F417, 1 Mbyte],
+ * STM32F401 [F401xE, 512 Kbytes], STM32F411 [F411xE, 512 Kbytes], STM32F446 [512 Kbytes],
+ * STM32F746 [F745/F746/F756, 1 Mbyte, requires the STM32F7 HAL] */
 #define STM32F429
 
 /* Define the value for CRC calculation using peripheral */
@@ -28,9 +31,19 @@ extern "C" {
 /* Define the value for CRC calculation using function */
 #define CRC_USING_FUNCTION   0
 
+/* Define the value for CRC calculation using peripheral, fed by DMA2 memory-to-memory transfers */
+#define CRC_USING_DMA        2
+
 /* Define the method of CRC calculation */
 #define CRC_CALCULATION_METHOD CRC_USING_PERIPHERAL
 
+/* DMA2 stream and channel feeding the CRC peripheral [CRC_USING_DMA]. Must not be used by other peripherals */
+#define SIMPLESD_CRC_DMA_STREAM  DMA2_Stream2
+#define SIMPLESD_CRC_DMA_CHANNEL DMA_CHANNEL_0
+
+/* Timeout of a DMA transfer to the CRC peripheral in ms */
+#define SIMPLESD_CRC_DMA_TIMEOUT 1000
+
 /* Enable or disable the internal WDT */
 #define SD_WATCHDOG_RUNNING	 1
 
@@ -40,10 +53,163 @@ extern "C" {
 /* Set the polynomial that will be used on CRC calculation using software function */
 #define CRC_POLYNOMIAL STM32_POLYNOMIAL
 
+/* Define the values for the location of the software CRC tables [CRC_USING_FUNCTION] */
+#define SIMPLESD_CRC_TABLE_FLASH  0   /* Constant tables of SimpleSD_crc_table.h, generated for CRC_POLYNOMIAL */
+#define SIMPLESD_CRC_TABLE_RAM    1   /* Built for CRC_POLYNOMIAL on first use, in SRAM */
+#define SIMPLESD_CRC_TABLE_CCMRAM 2   /* Built for CRC_POLYNOMIAL on first use, in CCMRAM [.ccmram section] */
+
+/* Set the location of the software CRC tables */
+#define SIMPLESD_CRC_TABLE_LOCATION SIMPLESD_CRC_TABLE_FLASH
+
+/* Set the number of bytes the software CRC processes per step [4: slicing-by-4, 8: slicing-by-8] */
+#define SIMPLESD_CRC_SLICES 8
+
 /* Set the time that code will wait for trigger start firmware upgrade */
 #define BOOTLOADER_TRIGGER_TIME 100
 
-#ifdef STM32F429
+/* Size of the staging buffer used to read the firmware file [multiple of 512 bytes, 4096 to 32768] */
+#define SIMPLESD_READ_BUFFER_SIZE 16384
+
+/* Enable or disable the read/program pipeline. When enabled, one buffer is programmed from the
+ * FLASH interrupt while the next one is read from the SD card. The read only overlaps with programming
+ * Bank 2, the code runs from Bank 1 and stalls while Bank 1 is programmed. Requires FLASH_IRQHandler()
+ * to call SimpleSD_FLASH_IRQHandler() */
+#define SIMPLESD_PIPELINE_ENABLED 1
+
+/* Priority of the FLASH interrupt used by the pipeline */
+#define SIMPLESD_FLASH_IRQ_PRIORITY 1
+
+/* Set the time in milliseconds a block or a sector erase driven by the FLASH interrupt may take before
+ * the upgrade is aborted. Above the maximum erase time of a 128 KB sector */
+#define SIMPLESD_FLASH_TIMEOUT 5000
+
+/* Set the supply voltage range of the device [FLASH_VOLTAGE_RANGE_1 to FLASH_VOLTAGE_RANGE_4]. It selects the
+ * widest flash parallelism allowed: x8, x16, x32, or x64 with an external VPP [FLASH_VOLTAGE_RANGE_4] */
+#define SIMPLESD_VOLTAGE_RANGE FLASH_VOLTAGE_RANGE_3
+
+/* Define the values for the programming engine used when the pipeline is disabled */
+#define SIMPLESD_PROGRAM_USING_HAL       0   /* HAL_FLASH_Program() for every word */
+#define SIMPLESD_PROGRAM_USING_REGISTERS 1   /* Loop running from SRAM, polling BSY, at the widest parallelism */
+
+/* Set the programming engine. Only used with SIMPLESD_PIPELINE_ENABLED 0, the pipeline programs from the FLASH
+ * interrupt. SimpleSD_Program_Benchmark() measures the engines against each other */
+#define SIMPLESD_PROGRAM_ENGINE SIMPLESD_PROGRAM_USING_REGISTERS
+
+/* Enable or disable skipping words equal to the erased value [0xFFFFFFFF] while programming.
+ * The words are still part of the CRC */
+#define SIMPLESD_SKIP_ERASED_WORDS 1
+
+/* Enable or disable the blank check. A sector already erased [all words 0xFFFFFFFF] is not erased again */
+#define SIMPLESD_BLANK_CHECK 1
+
+/* Define the values for the erase policy */
+#define SIMPLESD_ERASE_UPFRONT      0   /* All sectors of the image are erased before programming starts */
+#define SIMPLESD_ERASE_JUST_IN_TIME 1   /* Each sector is erased when the programming reaches it */
+
+/* Set the erase policy. SIMPLESD_DIFFERENTIAL always erases just in time the sectors that differ */
+#define SIMPLESD_ERASE_POLICY SIMPLESD_ERASE_UPFRONT
+
+/* Enable or disable erasing from the FLASH interrupt. While a sector of Bank 2 is erased the next part of the
+ * file is read ahead into the prefetch buffer, a Bank 1 erase stalls the code. Requires SIMPLESD_PIPELINE_ENABLED */
+#define SIMPLESD_ERASE_OVERLAP 0
+
+/* Size of the read-ahead buffer filled while sectors are erased [multiple of SIMPLESD_READ_BUFFER_SIZE] */
+#define SIMPLESD_PREFETCH_SIZE 65536
+
+/* Skip the upgrade when the installed firmware is the same as the file [header, size and CRC match
+ * and the CRC of the installed firmware is correct] */
+#define SIMPLESD_SKIP_IDENTICAL 0
+
+/* Enable or disable differential flashing. Every sector is compared with the file and only the
+ * sectors that differ are erased and programmed again */
+#define SIMPLESD_DIFFERENTIAL 0
+
+/* Define the values for the verification of each programmed block. It runs once the block is programmed,
+ * so the flash is not read back between the programmed words */
+#define SIMPLESD_BLOCK_VERIFY_FULL    0   /* Compare every word of the block */
+#define SIMPLESD_BLOCK_VERIFY_SAMPLED 1   /* Compare every SIMPLESD_VERIFY_SAMPLE_STEP word and the last one */
+#define SIMPLESD_BLOCK_VERIFY_CRC     2   /* Compare the CRC of the block in flash with the CRC of the source buffer */
+
+/* Define the verification of each programmed block */
+#define SIMPLESD_BLOCK_VERIFY SIMPLESD_BLOCK_VERIFY_FULL
+
+/* Distance in words between the compared words of SIMPLESD_BLOCK_VERIFY_SAMPLED */
+#define SIMPLESD_VERIFY_SAMPLE_STEP 64
+
+/* Define the values for the verification after the upgrade. The CRC of the image is always
+ * calculated on the data streamed to the flash and compared before the CRC word is programmed */
+#define SIMPLESD_VERIFY_NONE 0   /* No further verification */
+#define SIMPLESD_VERIFY_SPOT 1   /* Read back the image header and the CRC word from flash */
+#define SIMPLESD_VERIFY_FULL 2   /* Calculate the CRC of the image again from flash [SimpleSD_CRC_Check()] */
+
+/* Define the verification after the upgrade */
+#define SIMPLESD_POST_VERIFY SIMPLESD_VERIFY_SPOT
+
+/* Enable or disable the fast boot. Without an update request the bootloader jumps to the firmware right
+ * after the clock and CRC initialisation, skipping the SD card, FatFs and the trigger wait. The firmware
+ * requests an update with SimpleSD_RequestUpdate() followed by a reset. Only a trigger present at reset
+ * [e.g. a button held down] is seen by the fast boot, a UART trigger needs the firmware to request the update */
+#define SIMPLESD_FAST_BOOT 0
+
+/* Timer of the HAL time base [stm32f4xx_hal_timebase_tim.c], its counter gives the boot latency below the tick */
+#define SIMPLESD_TICK_TIMER TIM6
+
+/* RTC backup registers of the fast boot: update request and time from HAL_Init() to the jump [microseconds] */
+#define SIMPLESD_UPDATE_REQUEST_BKP 0
+#define SIMPLESD_BOOT_LATENCY_BKP   1
+
+/* Value of the update request register when an update is requested */
+#define SIMPLESD_UPDATE_REQUEST ((uint32_t)0x55504454)
+
+/* Enable or disable the verified stamp. Once the CRC of the firmware has been checked, a stamp [CRC word of the
+ * firmware and flash write generation] is kept in RTC backup registers and SimpleSD_BootCheck() skips the CRC
+ * calculation while the stamp matches. Every firmware upgrade increments the generation */
+#define SIMPLESD_VERIFIED_STAMP 1
+
+/* Calculate the CRC again every SIMPLESD_RECHECK_BOOTS boots, even with a valid stamp [0: never] */
+#define SIMPLESD_RECHECK_BOOTS 16
+
+/* RTC backup registers of the verified stamp */
+#define SIMPLESD_STAMP_CHECK_BKP 2
+#define SIMPLESD_GENERATION_BKP  3
+#define SIMPLESD_STAMP_BOOTS_BKP 4
+
+/* Enable or disable the block CRC table. A SimpleSD image may carry the CRC of every SIMPLESD_IMAGE_BLOCK_SIZE
+ * bytes: the sectors are checked against it once programmed, a sector failing the check is erased and programmed
+ * again, and a boot with a valid verified stamp checks one block of the installed firmware */
+#define SIMPLESD_BLOCK_CRC 0
+
+/* Times a sector failing the block CRC check is programmed again before the upgrade fails */
+#define SIMPLESD_SECTOR_RETRIES 2
+
+/* Enable or disable the upgrade journal. The sectors programmed and verified are recorded in RTC backup registers,
+ * an upgrade of the same file interrupted by a reset resumes at the first sector not completed. A power loss
+ * keeps the journal only with VBAT */
+#define SIMPLESD_JOURNAL 0
+
+/* RTC backup registers of the journal: CRC word of the image and address it is completed up to */
+#define SIMPLESD_JOURNAL_IMAGE_BKP    5
+#define SIMPLESD_JOURNAL_PROGRESS_BKP 6
+
+/* Enable or disable compressed firmware files. A file packed by SimpleSD_Tools/simplesd_lz4.py [independent LZ4
+ * blocks] is decompressed block by block while it is read, uncompressed files are read as before */
+#define SIMPLESD_LZ4 0
+
+/* Largest uncompressed block of a compressed firmware file. The decoder uses twice this size of RAM */
+#define SIMPLESD_LZ4_BLOCK_SIZE 16384
+
+/* Enable or disable patch files [SIMPLESD_DUAL_BANK only]. A firmware file made by SimpleSD_Tools/simplesd_delta.py
+ * is a patch to the installed firmware, the new firmware is rebuilt into the inactive slot. A patch made for another
+ * firmware falls back to the full image APPLICATION_FULL_FILENAME */
+#define SIMPLESD_DELTA 0
+
+#if SIMPLESD_PIPELINE_ENABLED
+	#define SIMPLESD_READ_BUFFERS 2
+#else
+	#define SIMPLESD_READ_BUFFERS 1
+#endif
+
+#if defined(STM32F429)
 	/* Base address of the Flash sectors Bank 1 */
 	#define ADDR_FLASH_SECTOR_0     ((uint32_t)0x08000000) /* Base @ of Sector 0, 16 Kbytes */
 	#define ADDR_FLASH_SECTOR_1     ((uint32_t)0x08004000) /* Base @ of Sector 1, 16 Kbytes */
@@ -71,6 +237,86 @@ extern "C" {
 	#define ADDR_FLASH_SECTOR_21     ((uint32_t)0x081A0000) /* Base @ of Sector 21, 128 Kbytes  */
 	#define ADDR_FLASH_SECTOR_22     ((uint32_t)0x081C0000) /* Base @ of Sector 22, 128 Kbytes */
 	#define ADDR_FLASH_SECTOR_23     ((uint32_t)0x081E0000) /* Base @ of Sector 23, 128 Kbytes */
+
+	#define SIMPLESD_FLASH_END_ADDRESS ((uint32_t)0x08200000)
+
+	/* Flash geometry: base address, size, bank and typical erase time [ms, x32 parallelism] of every sector */
+	#define SIMPLESD_FLASH_GEOMETRY \
+		{ADDR_FLASH_SECTOR_0,  0x04000, 1,  250}, {ADDR_FLASH_SECTOR_1,  0x04000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_2,  0x04000, 1,  250}, {ADDR_FLASH_SECTOR_3,  0x04000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_4,  0x10000, 1,  550}, {ADDR_FLASH_SECTOR_5,  0x20000, 1, 1100}, \
+		{ADDR_FLASH_SECTOR_6,  0x20000, 1, 1100}, {ADDR_FLASH_SECTOR_7,  0x20000, 1, 1100}, \
+		{ADDR_FLASH_SECTOR_8,  0x20000, 1, 1100}, {ADDR_FLASH_SECTOR_9,  0x20000, 1, 1100}, \
+		{ADDR_FLASH_SECTOR_10, 0x20000, 1, 1100}, {ADDR_FLASH_SECTOR_11, 0x20000, 1, 1100}, \
+		{ADDR_FLASH_SECTOR_12, 0x04000, 2,  250}, {ADDR_FLASH_SECTOR_13, 0x04000, 2,  250}, \
+		{ADDR_FLASH_SECTOR_14, 0x04000, 2,  250}, {ADDR_FLASH_SECTOR_15, 0x04000, 2,  250}, \
+		{ADDR_FLASH_SECTOR_16, 0x10000, 2,  550}, {ADDR_FLASH_SECTOR_17, 0x20000, 2, 1100}, \
+		{ADDR_FLASH_SECTOR_18, 0x20000, 2, 1100}, {ADDR_FLASH_SECTOR_19, 0x20000, 2, 1100}, \
+		{ADDR_FLASH_SECTOR_20, 0x20000, 2, 1100}, {ADDR_FLASH_SECTOR_21, 0x20000, 2, 1100}, \
+		{ADDR_FLASH_SECTOR_22, 0x20000, 2, 1100}, {ADDR_FLASH_SECTOR_23, 0x20000, 2, 1100}
+#elif defined(STM32F407)
+	/* Base address of the Flash sectors */
+	#define ADDR_FLASH_SECTOR_0     ((uint32_t)0x08000000) /* Base @ of Sector 0, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_1     ((uint32_t)0x08004000) /* Base @ of Sector 1, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_2     ((uint32_t)0x08008000) /* Base @ of Sector 2, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_3     ((uint32_t)0x0800C000) /* Base @ of Sector 3, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_4     ((uint32_t)0x08010000) /* Base @ of Sector 4, 64 Kbytes */
+	#define ADDR_FLASH_SECTOR_5     ((uint32_t)0x08020000) /* Base @ of Sector 5, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_6     ((uint32_t)0x08040000) /* Base @ of Sector 6, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_7     ((uint32_t)0x08060000) /* Base @ of Sector 7, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_8     ((uint32_t)0x08080000) /* Base @ of Sector 8, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_9     ((uint32_t)0x080A0000) /* Base @ of Sector 9, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_10    ((uint32_t)0x080C0000) /* Base @ of Sector 10, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_11    ((uint32_t)0x080E0000) /* Base @ of Sector 11, 128 Kbytes */
+
+	#define SIMPLESD_FLASH_END_ADDRESS ((uint32_t)0x08100000)
+
+	/* Flash geometry: base address, size, bank and typical erase time [ms, x32 parallelism] of every sector */
+	#define SIMPLESD_FLASH_GEOMETRY \
+		{ADDR_FLASH_SECTOR_0,  0x04000, 1,  250}, {ADDR_FLASH_SECTOR_1,  0x04000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_2,  0x04000, 1,  250}, {ADDR_FLASH_SECTOR_3,  0x04000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_4,  0x10000, 1,  700}, {ADDR_FLASH_SECTOR_5,  0x20000, 1, 1000}, \
+		{ADDR_FLASH_SECTOR_6,  0x20000, 1, 1000}, {ADDR_FLASH_SECTOR_7,  0x20000, 1, 1000}, \
+		{ADDR_FLASH_SECTOR_8,  0x20000, 1, 1000}, {ADDR_FLASH_SECTOR_9,  0x20000, 1, 1000}, \
+		{ADDR_FLASH_SECTOR_10, 0x20000, 1, 1000}, {ADDR_FLASH_SECTOR_11, 0x20000, 1, 1000}
+#elif defined(STM32F401) || defined(STM32F411) || defined(STM32F446)
+	/* Base address of the Flash sectors */
+	#define ADDR_FLASH_SECTOR_0     ((uint32_t)0x08000000) /* Base @ of Sector 0, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_1     ((uint32_t)0x08004000) /* Base @ of Sector 1, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_2     ((uint32_t)0x08008000) /* Base @ of Sector 2, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_3     ((uint32_t)0x0800C000) /* Base @ of Sector 3, 16 Kbytes */
+	#define ADDR_FLASH_SECTOR_4     ((uint32_t)0x08010000) /* Base @ of Sector 4, 64 Kbytes */
+	#define ADDR_FLASH_SECTOR_5     ((uint32_t)0x08020000) /* Base @ of Sector 5, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_6     ((uint32_t)0x08040000) /* Base @ of Sector 6, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_7     ((uint32_t)0x08060000) /* Base @ of Sector 7, 128 Kbytes */
+
+	#define SIMPLESD_FLASH_END_ADDRESS ((uint32_t)0x08080000)
+
+	/* Flash geometry: base address, size, bank and typical erase time [ms, x32 parallelism] of every sector */
+	#define SIMPLESD_FLASH_GEOMETRY \
+		{ADDR_FLASH_SECTOR_0,  0x04000, 1,  250}, {ADDR_FLASH_SECTOR_1,  0x04000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_2,  0x04000, 1,  250}, {ADDR_FLASH_SECTOR_3,  0x04000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_4,  0x10000, 1,  550}, {ADDR_FLASH_SECTOR_5,  0x20000, 1, 1100}, \
+		{ADDR_FLASH_SECTOR_6,  0x20000, 1, 1100}, {ADDR_FLASH_SECTOR_7,  0x20000, 1, 1100}
+#elif defined(STM32F746)
+	/* Base address of the Flash sectors [AXIM interface] */
+	#define ADDR_FLASH_SECTOR_0     ((uint32_t)0x08000000) /* Base @ of Sector 0, 32 Kbytes */
+	#define ADDR_FLASH_SECTOR_1     ((uint32_t)0x08008000) /* Base @ of Sector 1, 32 Kbytes */
+	#define ADDR_FLASH_SECTOR_2     ((uint32_t)0x08010000) /* Base @ of Sector 2, 32 Kbytes */
+	#define ADDR_FLASH_SECTOR_3     ((uint32_t)0x08018000) /* Base @ of Sector 3, 32 Kbytes */
+	#define ADDR_FLASH_SECTOR_4     ((uint32_t)0x08020000) /* Base @ of Sector 4, 128 Kbytes */
+	#define ADDR_FLASH_SECTOR_5     ((uint32_t)0x08040000) /* Base @ of Sector 5, 256 Kbytes */
+	#define ADDR_FLASH_SECTOR_6     ((uint32_t)0x08080000) /* Base @ of Sector 6, 256 Kbytes */
+	#define ADDR_FLASH_SECTOR_7     ((uint32_t)0x080C0000) /* Base @ of Sector 7, 256 Kbytes */
+
+	#define SIMPLESD_FLASH_END_ADDRESS ((uint32_t)0x08100000)
+
+	/* Flash geometry: base address, size, bank and typical erase time [ms, x32 parallelism] of every sector */
+	#define SIMPLESD_FLASH_GEOMETRY \
+		{ADDR_FLASH_SECTOR_0,  0x08000, 1,  250}, {ADDR_FLASH_SECTOR_1,  0x08000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_2,  0x08000, 1,  250}, {ADDR_FLASH_SECTOR_3,  0x08000, 1,  250}, \
+		{ADDR_FLASH_SECTOR_4,  0x20000, 1, 1000}, {ADDR_FLASH_SECTOR_5,  0x40000, 1, 2000}, \
+		{ADDR_FLASH_SECTOR_6,  0x40000, 1, 2000}, {ADDR_FLASH_SECTOR_7,  0x40000, 1, 2000}
 #else
 	#error "Define the target MCU..."
 #endif
@@ -78,8 +324,29 @@ extern "C" {
 /* Main firmware base address */
 #define APPLICATION_START_ADDRESS ((uint32_t)0x08020000)
 
-/* Main firmware end address [including the CRC] */
-#define APPLICATION_END_ADDRESS ((uint32_t)0x081FFFFF)
+/* Enable or disable the A/B dual bank layout. The firmware is installed to the inactive slot while the
+ * active one stays intact, and the newest slot with a correct CRC is booted. Slot B [Bank 2] is started by
+ * mapping Bank 2 at 0x08000000 [SYSCFG UFB_MODE], so both slots run the same binary linked at
+ * APPLICATION_START_ADDRESS. Not combined with SIMPLESD_DIFFERENTIAL */
+#define SIMPLESD_DUAL_BANK 0
+
+#if SIMPLESD_DUAL_BANK
+	/* Flash address of the slots, slot B is at the same offset of Bank 2 */
+	#define SIMPLESD_SLOT_A_ADDRESS ADDR_FLASH_SECTOR_5
+	#define SIMPLESD_SLOT_B_ADDRESS ADDR_FLASH_SECTOR_17
+	#define SIMPLESD_SLOT_SIZE      (ADDR_FLASH_SECTOR_12 - ADDR_FLASH_SECTOR_5)
+
+	/* Size of the slot record [sequence number] programmed right after the CRC of the image */
+	#define SIMPLESD_SLOT_RECORD_SIZE 4
+
+	/* Main firmware end address [including the CRC], the size of a slot */
+	#define APPLICATION_END_ADDRESS (APPLICATION_START_ADDRESS + SIMPLESD_SLOT_SIZE - 1)
+#else
+	#define SIMPLESD_SLOT_RECORD_SIZE 0
+
+	/* Main firmware end address [including the CRC], the end of the flash */
+	#define APPLICATION_END_ADDRESS (SIMPLESD_FLASH_END_ADDRESS - 1)
+#endif
 
 /* Main firmware CRC size */
 #define APPLICATION_CRC_SIZE 4
@@ -90,10 +357,32 @@ extern "C" {
 /* Main firmware CRC address */
 #define APPLICATION_CRC_ADDRESS (APPLICATION_END_ADDRESS-APPLICATION_CRC_SIZE+1)
 
+/* Size of the application area */
+#define APPLICATION_MAX_SIZE ((uint32_t)(APPLICATION_END_ADDRESS - APPLICATION_START_ADDRESS + 1))
+
+/* SimpleSD image: the reserved vector table entries 7-9 of the application carry the image description
+ * and the CRC of the image is appended right after it [see SimpleSD_Tools/simplesd_image.py] */
+#define SIMPLESD_IMAGE_MAGIC          ((uint32_t)0x5344494D)  /* "MIDS" */
+#define SIMPLESD_IMAGE_MAGIC_OFFSET   0x1C   /* Vector 7:  SIMPLESD_IMAGE_MAGIC */
+#define SIMPLESD_IMAGE_SIZE_OFFSET    0x20   /* Vector 8:  Image size in bytes without the CRC */
+#define SIMPLESD_IMAGE_VERSION_OFFSET 0x24   /* Vector 9:  Firmware version */
+#define SIMPLESD_IMAGE_BLOCKS_OFFSET  0x28   /* Vector 10: Offset of the block CRC table in the image, 0 if none */
+#define SIMPLESD_IMAGE_BLOCK_SIZE     0x10000 /* Bytes covered by each CRC of the block CRC table */
+
+/* First word of a compressed firmware file [see SimpleSD_Tools/simplesd_lz4.py] */
+#define SIMPLESD_LZ4_MAGIC ((uint32_t)0x5A4C4453)  /* "SDLZ" */
+
+/* First word of a patch [see SimpleSD_Tools/simplesd_delta.py] */
+#define SIMPLESD_DELTA_MAGIC ((uint32_t)0x50444453)  /* "SDDP" */
+#define SIMPLESD_IMAGE_HEADER_SIZE    0x40   /* Bytes read from the start of the file to identify the image */
+
 #define APPLICATION_FS_DIR "/"
 
 #define APPLICATION_BIN_FILENAME "Firmware.bin"
 
+/* Full image installed when APPLICATION_BIN_FILENAME is a patch for another firmware [SIMPLESD_DELTA] */
+#define APPLICATION_FULL_FILENAME "Full.bin"
+
 #define SDSimple_CD_Detect_Samples 10
 
 #define SDSimple_CD_Detect_Level 0
@@ -104,6 +393,37 @@ extern "C" {
 #define SDSimple_CD_Pin  GPIO_PIN_8
 #define SDSimple_CD_Port GPIOC
 
+#if SIMPLESD_ERASE_OVERLAP && !SIMPLESD_PIPELINE_ENABLED
+	#error "SIMPLESD_ERASE_OVERLAP requires SIMPLESD_PIPELINE_ENABLED"
+#endif
+
+#if SIMPLESD_ERASE_OVERLAP && (SIMPLESD_PREFETCH_SIZE % SIMPLESD_READ_BUFFER_SIZE)
+	#error "SIMPLESD_PREFETCH_SIZE must be a multiple of SIMPLESD_READ_BUFFER_SIZE"
+#endif
+
+#if SIMPLESD_DUAL_BANK && !defined(STM32F429)
+	#error "SIMPLESD_DUAL_BANK requires the 2 Mbytes dual bank flash of STM32F429"
+#endif
+
+#if SIMPLESD_DELTA && !SIMPLESD_DUAL_BANK
+	#error "SIMPLESD_DELTA requires SIMPLESD_DUAL_BANK, the patch is applied to the active slot"
+#endif
+
+#if SIMPLESD_DUAL_BANK && SIMPLESD_DIFFERENTIAL
+	#error "SIMPLESD_DIFFERENTIAL can not be used with SIMPLESD_DUAL_BANK"
+#endif
+
+#if (SIMPLESD_CRC_SLICES != 4) && (SIMPLESD_CRC_SLICES != 8)
+	#error "SIMPLESD_CRC_SLICES must be 4 or 8"
+#endif
+
+#if SIMPLESD_LZ4 && ((SIMPLESD_LZ4_BLOCK_SIZE % 4) != 0)
+	#error "SIMPLESD_LZ4_BLOCK_SIZE must be a multiple of 4"
+#endif
+
+#if ((SIMPLESD_READ_BUFFER_SIZE % 512) != 0) || (SIMPLESD_READ_BUFFER_SIZE < 512)
+	#error "SIMPLESD_READ_BUFFER_SIZE must be a multiple of the SD sector size (512 bytes)"
+#endif
 
 
 enum SimpleSD_ErrorCodes
@@ -116,6 +436,12 @@ enum SimpleSD_ErrorCodes
 	SIMPLESD_FLASH_ERASE_ERROR,		 	/* Flash Erase error */
 	SIMPLESD_FLASH_WRITE_ERROR,		 	/* Flash Write error */
 	SIMPLESD_FLASH_WRITE_COMPARE_ERROR, /* Flash Data Compare error */
+	SIMPLESD_IMAGE_SIZE_ERROR,			/* Firmware file does not fit the application area */
+	SIMPLESD_IMAGE_CRC_ERROR,			/* CRC of the firmware file is wrong */
+	SIMPLESD_VERIFY_ERROR,				/* Verification after the upgrade failed */
+	SIMPLESD_FIRMWARE_UP_TO_DATE,		/* Installed firmware is the same as the file, nothing programmed */
+	SIMPLESD_DELTA_BASE_ERROR,			/* Firmware file is a patch for another firmware and there is no full image */
+	SIMPLESD_PROGRAM_BUSY = 0xFF,		/* Flash programming in progress [internal] */
 };
 
 enum SimpleSD_LEDModes
@@ -141,15 +467,92 @@ enum SimpleSD_CRC
 	SIMPLESD_CRC_ERROR   = 1,	 /* Calculated CRC and stored CRC are different */
 };
 
+/* Result of SimpleSD_CRC_Benchmark(), all times in microseconds */
+typedef struct
+{
+	uint32_t Words;          /* Words of the installed image */
+	uint32_t HALTime;        /* CRC peripheral fed by the CPU [HAL_CRC_Calculate()] */
+	uint32_t DMATime;        /* CRC peripheral fed by DMA2 */
+	uint32_t HALCRC;         /* CRC calculated by the CPU fed peripheral */
+	uint32_t DMACRC;         /* CRC calculated by the DMA fed peripheral [DMAStatus HAL_OK only] */
+	uint8_t  DMAStatus;      /* HAL status of the DMA transfers */
+} SimpleSD_CRCBenchmarkTypeDef;
+
+/* Result of SimpleSD_Program_Benchmark(), all times in microseconds */
+typedef struct
+{
+	uint32_t Words;          /* Words programmed by each engine [one read buffer] */
+	uint32_t Sector;         /* Flash sector used, erased before and after */
+	uint32_t HALTime;        /* HAL_FLASH_Program() for every word [SIMPLESD_PROGRAM_USING_HAL] */
+	uint32_t RAMTime;        /* Loop running from SRAM [SIMPLESD_PROGRAM_USING_REGISTERS] */
+	uint32_t InterruptTime;  /* FLASH interrupt, read back included [SIMPLESD_PIPELINE_ENABLED, 0 otherwise] */
+} SimpleSD_ProgramBenchmarkTypeDef;
+
+/* Flash sector of the geometry table, see SIMPLESD_FLASH_GEOMETRY */
+typedef struct
+{
+	uint32_t Base;           /* Base address of the sector */
+	uint32_t Size;           /* Size of the sector in bytes */
+	uint16_t Bank;           /* Flash bank of the sector [1 or 2] */
+	uint16_t EraseTime;      /* Typical erase time in milliseconds [x32 parallelism] */
+} SimpleSD_SectorTypeDef;
+
+/* Timing of the last firmware upgrade, all times in microseconds */
+typedef struct
+{
+	uint32_t TotalTime;      /* Time from start to end of the upgrade */
+	uint32_t EraseTime;      /* Time spent erasing the application area */
+	uint32_t ReadTime;       /* Time spent reading the firmware file from the SD card */
+	uint32_t ProgramTime;    /* Time the flash programming was running */
+	uint32_t WaitTime;       /* Time the SD reader waited for the flash programming to finish */
+	uint32_t CRCTime;        /* Time spent calculating the CRC of the streamed image */
+	uint32_t VerifyTime;     /* Time spent on the verification after the upgrade */
+	uint32_t BytesRead;      /* Bytes read from the firmware file */
+	uint32_t ErasedSectors;  /* Number of erased flash sectors */
+	uint32_t CompareTime;    /* Time spent comparing the file with the flash [SIMPLESD_DIFFERENTIAL] */
+	uint32_t SkippedSectors; /* Sectors left untouched because they hold the content of the file [SIMPLESD_DIFFERENTIAL] */
+	uint32_t RewrittenSectors; /* Sectors erased and programmed because they differ from the file [SIMPLESD_DIFFERENTIAL] */
+	uint32_t PrefetchedBytes; /* Bytes read ahead while sectors were erased [SIMPLESD_ERASE_OVERLAP] */
+	uint32_t BlankSectors;   /* Sectors found blank and not erased [SIMPLESD_BLANK_CHECK] */
+	uint32_t BlankCheckTime; /* Time spent on the blank check [SIMPLESD_BLANK_CHECK] */
+	uint32_t ErasedWords;    /* Words of the file equal to 0xFFFFFFFF and not programmed [SIMPLESD_SKIP_ERASED_WORDS] */
+	uint32_t BlockVerifyTime; /* Time spent comparing the programmed blocks [SIMPLESD_BLOCK_VERIFY] */
+	uint32_t BlockCRCTime;   /* Time spent checking the programmed sectors with the block CRC table [SIMPLESD_BLOCK_CRC] */
+	uint32_t RetriedSectors; /* Sectors programmed again after failing the block CRC check [SIMPLESD_BLOCK_CRC] */
+	uint32_t ResumedBytes;   /* Bytes programmed by an interrupted upgrade and not programmed again [SIMPLESD_JOURNAL] */
+	uint32_t CompressedBytes; /* Bytes of a compressed firmware file read from the SD card [SIMPLESD_LZ4] */
+	uint32_t DecodeTime;     /* Time spent decompressing, included in ReadTime [SIMPLESD_LZ4] */
+	uint32_t PatchBytes;     /* Bytes of the patch read, controls included [SIMPLESD_DELTA] */
+} SimpleSD_StatisticsTypeDef;
+
 uint8_t SimpleSD_FirmwareUpgrade(void);
+void SimpleSD_FLASH_IRQHandler(void);
+const SimpleSD_StatisticsTypeDef *SimpleSD_GetStatistics(void);
 uint32_t SimpleSD_FindSector(uint32_t Address);
+const SimpleSD_SectorTypeDef *SimpleSD_GetSector(uint32_t Sector);
 uint8_t SimpleSD_DetectCard(void);
 void SimpleSD_JumpToMainFirmware(void);
 void SimpleSD_BlinkLED(void);
 void SimpleSD_DeInit(void);
 void SimpleSD_ModeLED(uint8_t Mode);
 uint8_t SimpleSD_CRC_Check(void);
+uint8_t SimpleSD_BootCheck(void);
+uint32_t SimpleSD_ActiveSlot(void);
+uint32_t SimpleSD_ImageSize(void);
+uint32_t SimpleSD_ImageSizeFromHeader(const uint32_t *Header);
+uint32_t SimpleSD_CRC_Update(uint32_t Crc, const uint32_t *Data, uint32_t Words);
+#if CRC_CALCULATION_METHOD != CRC_USING_FUNCTION
+void SimpleSD_CRC_Benchmark(SimpleSD_CRCBenchmarkTypeDef *Result);
+#endif
+uint8_t SimpleSD_Program_Benchmark(SimpleSD_ProgramBenchmarkTypeDef *Result);
 uint32_t CalculateCRC_32(uint32_t crc, uint32_t data);
+#if SIMPLESD_FAST_BOOT
+void SimpleSD_FastBoot(void);
+void SimpleSD_RequestUpdate(void);
+uint8_t SimpleSD_UpdateRequested(void);
+void SimpleSD_ClearUpdateRequest(void);
+uint32_t SimpleSD_BootLatency(void);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Generate SimpleSD_crc_table.h, the slicing-by-8 tables of the software CRC.
+
+Table k holds the CRC register after 8*(k+1) shifts of a byte placed in the
+top byte of the register, for the non-reflected CRC of the STM32 CRC unit.
+"""
+
+import argparse
+
+STM32_POLYNOMIAL = 0x04C11DB7
+SLICES = 8
+
+HEADER = """/**
+  ******************************************************************************
+  * @file    SimpleSD_crc_table.h
+  * @brief   Slicing-by-8 tables of the software CRC, generated by
+  *          SimpleSD_Tools/simplesd_crc_table.py. Do not edit
+  ******************************************************************************
+  */
+
+#ifndef __SIMPLESD_CRC_TABLE_H
+#define __SIMPLESD_CRC_TABLE_H
+
+/* Polynomial the tables have been generated for */
+#define SIMPLESD_CRC_TABLE_POLYNOMIAL ((uint32_t)0x%08X)
+
+static const uint32_t SimpleSD_CRC_Table[%d][256] =
+{
+"""
+
+FOOTER = """};
+
+#endif /* __SIMPLESD_CRC_TABLE_H */
+"""
+
+
+def shift(crc, polynomial, count):
+    for _ in range(count):
+        crc = ((crc << 1) ^ polynomial) if crc & 0x80000000 else (crc << 1)
+        crc &= 0xFFFFFFFF
+    return crc
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("output", help="path of SimpleSD_crc_table.h")
+    parser.add_argument("--polynomial", type=lambda v: int(v, 0), default=STM32_POLYNOMIAL)
+    args = parser.parse_args()
+
+    with open(args.output, "w", newline="\n") as f:
+        f.write(HEADER % (args.polynomial, SLICES))
+        for k in range(SLICES):
+            f.write("\t{\n")
+            for row in range(0, 256, 8):
+                words = [shift(i << 24, args.polynomial, 8 * (k + 1)) for i in range(row, row + 8)]
+                f.write("\t\t" + ", ".join("0x%08X" % w for w in words) + ",\n")
+            f.write("\t},\n")
+        f.write(FOOTER)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Make a patch that updates one SimpleSD image to another.
+
+The bootloader applies the patch to the installed firmware while it reads the
+file and programs the new firmware into the inactive slot [SIMPLESD_DELTA with
+SIMPLESD_DUAL_BANK]. The patch only applies to the exact image it was made
+from, the bootloader checks the CRC word and the size of the installed
+firmware first and installs Full.bin instead when they differ. The patch
+is laid out as:
+
+    "SDDP" | CRC word of the base image | base size | new size   (4 words)
+    records of:
+        diff length | extra length | seek                         (3 words)
+        diff bytes, added byte by byte to the base image
+        extra bytes, copied to the new image
+    the seek moves in the base image after the record [signed]
+
+Sizes exclude the CRC word of the base image and include the one of the new
+image. The diff bytes of unchanged code are zeros, the patch is packed as a
+compressed firmware file [SIMPLESD_LZ4] unless --no-lz4 is given.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import simplesd_lz4  # noqa: E402
+
+SIMPLESD_DELTA_MAGIC = 0x50444453
+SIMPLESD_DELTA_HEADER_SIZE = 16
+SIMPLESD_IMAGE_SIZE_OFFSET = 0x20
+APPLICATION_CRC_SIZE = 4
+
+SEED = 8
+SLACK = 64
+
+
+def _extend(old, new, o, n, step, limit):
+    """Length of the approximate match from old[o] and new[n] going in step direction, bsdiff score."""
+    best = matches = length = 0
+    for k in range(1, limit + 1):
+        a, b = (o + k - 1, n + k - 1) if step > 0 else (o - k, n - k)
+        if old[a] == new[b]:
+            matches += 1
+        if 2 * matches - k > best:
+            best = 2 * matches - k
+            length = k
+        elif k - length > SLACK:
+            break
+    return length
+
+
+def regions(old, new):
+    """Approximate matches of new in old as (new offset, old offset, length), in new order."""
+    index = {}
+    for i in range(len(old) - SEED + 1):
+        index.setdefault(old[i:i + SEED], i)
+    found = []
+    end = 0
+    offset = 0
+    i = 0
+    while i <= len(new) - SEED:
+        key = new[i:i + SEED]
+        o = i + offset
+        if not (0 <= o <= len(old) - SEED and old[o:o + SEED] == key):
+            o = index.get(key)
+            if o is None:
+                i += 1
+                continue
+        length = _extend(old, new, o, i, 1, min(len(new) - i, len(old) - o))
+        back = _extend(old, new, o, i, -1, min(i - end, o))
+        found.append((i - back, o - back, length + back))
+        offset = o - i
+        end = i = i + length
+    return found
+
+
+def make_patch(old, new):
+    base_size = len(old) - APPLICATION_CRC_SIZE
+    (base_crc,) = struct.unpack_from("<I", old, base_size)
+    (size,) = struct.unpack_from("<I", old, SIMPLESD_IMAGE_SIZE_OFFSET)
+    if size != base_size:
+        raise ValueError("base is not a SimpleSD image [simplesd_image.py output]")
+
+    out = [struct.pack("<4I", SIMPLESD_DELTA_MAGIC, base_crc, base_size, len(new))]
+    matches = regions(old[:base_size], new)
+    # A leading record copies the bytes before the first match and seeks to it
+    records = [(0, 0, 0)] + matches
+    for k, (n, o, length) in enumerate(records):
+        if k + 1 < len(records):
+            next_n, next_o, _ = records[k + 1]
+        else:
+            next_n, next_o = len(new), o + length
+        if k == 0 and next_n == 0 and next_o == 0:
+            continue
+        diff = bytes((new[n + j] - old[o + j]) & 0xFF for j in range(length))
+        out.append(struct.pack("<IIi", length, next_n - n - length, next_o - o - length))
+        out.append(diff)
+        out.append(new[n + length:next_n])
+    return b"".join(out)
+
+
+def apply_patch(old, patch):
+    """Reference of the bootloader, the same checks as SimpleSD_DeltaControl()."""
+    magic, base_crc, base_size, size = struct.unpack_from("<4I", patch)
+    if magic != SIMPLESD_DELTA_MAGIC or base_size + APPLICATION_CRC_SIZE != len(old) or \
+            struct.unpack_from("<I", old, base_size)[0] != base_crc:
+        raise ValueError("patch is for another base image")
+    new = bytearray()
+    pos = SIMPLESD_DELTA_HEADER_SIZE
+    o = 0
+    while len(new) < size:
+        diff, extra, seek = struct.unpack_from("<IIi", patch, pos)
+        pos += 12
+        if o > base_size or diff > base_size - o or diff + extra > size - len(new):
+            raise ValueError("record out of the image at patch offset 0x%X" % (pos - 12))
+        new += bytes((patch[pos + j] + old[o + j]) & 0xFF for j in range(diff))
+        new += patch[pos + diff:pos + diff + extra]
+        pos += diff + extra
+        o += diff + seek
+    return bytes(new)
+
+
+def records(patch):
+    """Number of records of a patch."""
+    (size,) = struct.unpack_from("<I", patch, 12)
+    pos = SIMPLESD_DELTA_HEADER_SIZE
+    count = written = 0
+    while written < size:
+        diff, extra, _ = struct.unpack_from("<IIi", patch, pos)
+        pos += 12 + diff + extra
+        written += diff + extra
+        count += 1
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("base", help="SimpleSD image installed on the target")
+    parser.add_argument("input", help="new SimpleSD image")
+    parser.add_argument("output", help="patch to copy on the SD card [8.3 name], next to the new image as Full.bin")
+    parser.add_argument("--no-lz4", action="store_true", help="do not compress the patch, for SIMPLESD_LZ4 0")
+    parser.add_argument("--block-size", type=lambda v: int(v, 0), default=simplesd_lz4.SIMPLESD_LZ4_BLOCK_SIZE,
+                        help="uncompressed block size of the compressed patch")
+    args = parser.parse_args()
+
+    with open(args.base, "rb") as f:
+        old = f.read()
+    with open(args.input, "rb") as f:
+        new = f.read()
+    try:
+        patch = make_patch(old, new)
+        if apply_patch(old, patch) != new:
+            raise ValueError("patch does not rebuild the new image")
+        data = patch if args.no_lz4 else simplesd_lz4.pack(patch, args.block_size)
+    except ValueError as e:
+        sys.exit("simplesd_delta: %s" % e)
+    with open(args.output, "wb") as f:
+        f.write(data)
+
+    print("%s: %d bytes read instead of %d (%.1f %%), %d records%s" % (
+        args.output, len(data), len(new), 100.0 * len(data) / len(new), records(patch),
+        "" if args.no_lz4 else ", compressed"))
+
+
+if __name__ == "__main__":
+    main()
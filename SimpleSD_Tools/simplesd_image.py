@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Convert an application .bin into a SimpleSD image.
+
+The reserved Cortex-M vector table entries 7-10 of the image are patched with
+the SimpleSD magic, the image size, the firmware version and the offset of the
+block CRC table. The block CRC table (one CRC per 64 KB block of the
+application) is appended, then the CRC of the whole image. The CRCs are the
+ones computed by the STM32 CRC unit (CRC-32/MPEG-2 over little endian words,
+init 0xFFFFFFFF, no reflection).
+"""
+
+import argparse
+import struct
+import sys
+
+SIMPLESD_IMAGE_MAGIC = 0x5344494D
+SIMPLESD_IMAGE_MAGIC_OFFSET = 0x1C
+SIMPLESD_IMAGE_SIZE_OFFSET = 0x20
+SIMPLESD_IMAGE_VERSION_OFFSET = 0x24
+SIMPLESD_IMAGE_BLOCKS_OFFSET = 0x28
+SIMPLESD_IMAGE_BLOCK_SIZE = 0x10000
+SIMPLESD_IMAGE_HEADER_SIZE = 0x40
+
+STM32_POLYNOMIAL = 0x04C11DB7
+
+# Application area of SimpleSD_bootloader.h [APPLICATION_START_ADDRESS to the end of the flash]
+APPLICATION_START_ADDRESS = 0x08020000
+FLASH_END_ADDRESS = {
+    "STM32F429": 0x08200000,
+    "STM32F407": 0x08100000,
+    "STM32F401": 0x08080000,
+    "STM32F411": 0x08080000,
+    "STM32F446": 0x08080000,
+    "STM32F746": 0x08100000,
+}
+APPLICATION_CRC_SIZE = 4
+
+
+def _crc_table():
+    table = []
+    for i in range(256):
+        crc = i << 24
+        for _ in range(8):
+            crc = ((crc << 1) ^ STM32_POLYNOMIAL) if crc & 0x80000000 else (crc << 1)
+        table.append(crc & 0xFFFFFFFF)
+    return table
+
+
+CRC_TABLE = _crc_table()
+
+
+def stm32_crc(data, crc=0xFFFFFFFF):
+    """CRC of the STM32 CRC unit fed with the words of data."""
+    for (word,) in struct.iter_unpack("<I", data):
+        for shift in (24, 16, 8, 0):
+            crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[((crc >> 24) ^ (word >> shift)) & 0xFF]
+    return crc
+
+
+def build_image(app, version, mcu="STM32F429", block_crc=True):
+    image = bytearray(app)
+    if len(image) % 4:
+        image += b"\xff" * (4 - len(image) % 4)
+    if len(image) < SIMPLESD_IMAGE_HEADER_SIZE:
+        raise ValueError("image is smaller than the vector table header")
+    table_offset = len(image)
+    blocks = -(-table_offset // SIMPLESD_IMAGE_BLOCK_SIZE) if block_crc else 0
+    if table_offset + 4 * blocks + APPLICATION_CRC_SIZE > FLASH_END_ADDRESS[mcu] - APPLICATION_START_ADDRESS:
+        raise ValueError("image does not fit in the application area")
+
+    for offset in (SIMPLESD_IMAGE_MAGIC_OFFSET, SIMPLESD_IMAGE_SIZE_OFFSET, SIMPLESD_IMAGE_VERSION_OFFSET,
+                   SIMPLESD_IMAGE_BLOCKS_OFFSET):
+        (word,) = struct.unpack_from("<I", image, offset)
+        (magic,) = struct.unpack_from("<I", image, SIMPLESD_IMAGE_MAGIC_OFFSET)
+        if word != 0 and magic != SIMPLESD_IMAGE_MAGIC:
+            raise ValueError("reserved vector 0x%02X is in use (0x%08X)" % (offset, word))
+
+    struct.pack_into("<I", image, SIMPLESD_IMAGE_MAGIC_OFFSET, SIMPLESD_IMAGE_MAGIC)
+    struct.pack_into("<I", image, SIMPLESD_IMAGE_SIZE_OFFSET, table_offset + 4 * blocks)
+    struct.pack_into("<I", image, SIMPLESD_IMAGE_VERSION_OFFSET, version)
+    struct.pack_into("<I", image, SIMPLESD_IMAGE_BLOCKS_OFFSET, table_offset if blocks else 0)
+
+    # The blocks are hashed with the final header, the table itself is covered by the image CRC
+    for start in range(0, table_offset if blocks else 0, SIMPLESD_IMAGE_BLOCK_SIZE):
+        image += struct.pack("<I", stm32_crc(image[start:min(start + SIMPLESD_IMAGE_BLOCK_SIZE, table_offset)]))
+    return bytes(image) + struct.pack("<I", stm32_crc(image))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="application .bin linked at APPLICATION_START_ADDRESS")
+    parser.add_argument("output", help="SimpleSD image to copy on the SD card [8.3 name]")
+    parser.add_argument("--version", type=lambda v: int(v, 0), default=0, help="firmware version word")
+    parser.add_argument("--mcu", choices=sorted(FLASH_END_ADDRESS), default="STM32F429", help="target MCU of the bootloader")
+    parser.add_argument("--no-block-crc", action="store_true", help="do not append the block CRC table")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        app = f.read()
+    try:
+        image = build_image(app, args.version, args.mcu, not args.no_block_crc)
+    except ValueError as e:
+        sys.exit("simplesd_image: %s" % e)
+    with open(args.output, "wb") as f:
+        f.write(image)
+
+    (crc,) = struct.unpack_from("<I", image, len(image) - APPLICATION_CRC_SIZE)
+    print("%s: %d bytes, version 0x%08X, CRC 0x%08X" % (args.output, len(image) - APPLICATION_CRC_SIZE, args.version, crc))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""Pack a SimpleSD image into a compressed firmware file.
+
+The image is cut into blocks of --block-size bytes, each compressed on its own
+in the LZ4 block format, so the bootloader decompresses the file block by
+block with two block buffers of RAM. A block that does not get smaller is
+stored uncompressed. The file is laid out as:
+
+    "SDLZ" | image size | block size | number of blocks    (4 words)
+    file offset of every block and of the end of the file  (blocks + 1 words)
+    blocks
+
+The lz4 package is used for high compression when installed, otherwise a
+built-in greedy compressor.
+"""
+
+import argparse
+import struct
+import sys
+
+SIMPLESD_LZ4_MAGIC = 0x5A4C4453
+SIMPLESD_LZ4_HEADER_SIZE = 16
+SIMPLESD_LZ4_BLOCK_SIZE = 16384
+
+MIN_MATCH = 4
+LAST_LITERALS = 5
+MATCH_LIMIT = 12
+MAX_OFFSET = 65535
+
+try:
+    import lz4.block
+except ImportError:
+    lz4 = None
+
+
+def _length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+
+def _sequence(out, literals, offset, match):
+    token = min(len(literals), 15) << 4
+    if offset:
+        token |= min(match - MIN_MATCH, 15)
+    out.append(token)
+    if len(literals) >= 15:
+        _length(out, len(literals) - 15)
+    out += literals
+    if offset:
+        out += struct.pack("<H", offset)
+        if match - MIN_MATCH >= 15:
+            _length(out, match - MIN_MATCH - 15)
+
+
+def compress_block(data):
+    """LZ4 block of data, greedy parsing with the last position of every 4 byte sequence."""
+    if lz4 is not None:
+        return lz4.block.compress(data, mode="high_compression", compression=12, store_size=False)
+
+    out = bytearray()
+    last = {}
+    anchor = i = 0
+    limit = len(data) - MATCH_LIMIT
+    while i < limit:
+        key = data[i:i + MIN_MATCH]
+        candidate = last.get(key)
+        last[key] = i
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+        match = MIN_MATCH
+        end = len(data) - LAST_LITERALS - i
+        while match < end and data[candidate + match] == data[i + match]:
+            match += 1
+        _sequence(out, data[anchor:i], i - candidate, match)
+        i += match
+        anchor = i
+    _sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+
+def decompress_block(data, size):
+    """Reference decoder, the same checks as SimpleSD_LZ4_Decode()."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        token = data[i]
+        i += 1
+        length = token >> 4
+        if length == 15:
+            while True:
+                length += data[i]
+                i += 1
+                if data[i - 1] != 255:
+                    break
+        out += data[i:i + length]
+        i += length
+        if i == len(data):
+            break
+        offset = data[i] | data[i + 1] << 8
+        i += 2
+        if offset == 0 or offset > len(out):
+            raise ValueError("invalid match offset")
+        length = token & 0x0F
+        if length == 15:
+            while True:
+                length += data[i]
+                i += 1
+                if data[i - 1] != 255:
+                    break
+        for _ in range(length + MIN_MATCH):
+            out.append(out[-offset])
+    if len(out) != size:
+        raise ValueError("block decompresses to %d bytes instead of %d" % (len(out), size))
+    return bytes(out)
+
+
+def pack(image, block_size=SIMPLESD_LZ4_BLOCK_SIZE):
+    if block_size % 4:
+        raise ValueError("block size must be a multiple of 4")
+    blocks = []
+    for start in range(0, len(image), block_size):
+        data = image[start:start + block_size]
+        compressed = compress_block(data)
+        if decompress_block(compressed, len(data)) != data:
+            raise ValueError("block at 0x%X does not decompress to its data" % start)
+        blocks.append(compressed if len(compressed) < len(data) else data)
+
+    offset = SIMPLESD_LZ4_HEADER_SIZE + 4 * (len(blocks) + 1)
+    index = []
+    for block in blocks:
+        index.append(offset)
+        offset += len(block)
+    index.append(offset)
+
+    header = struct.pack("<4I", SIMPLESD_LZ4_MAGIC, len(image), block_size, len(blocks))
+    return header + struct.pack("<%dI" % len(index), *index) + b"".join(blocks)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", help="SimpleSD image [simplesd_image.py output]")
+    parser.add_argument("output", help="compressed firmware file to copy on the SD card [8.3 name]")
+    parser.add_argument("--block-size", type=lambda v: int(v, 0), default=SIMPLESD_LZ4_BLOCK_SIZE,
+                        help="uncompressed block size, at most SIMPLESD_LZ4_BLOCK_SIZE of the bootloader")
+    parser.add_argument("--read-rate", type=float,
+                        help="SD read rate of the target in KB/s [BytesRead / ReadTime of SimpleSD_GetStatistics()], "
+                             "estimates the read time saved")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        image = f.read()
+    try:
+        packed = pack(image, args.block_size)
+    except ValueError as e:
+        sys.exit("simplesd_lz4: %s" % e)
+    with open(args.output, "wb") as f:
+        f.write(packed)
+
+    print("%s: %d bytes read instead of %d (%.1f %%), %s compressor" % (
+        args.output, len(packed), len(image), 100.0 * len(packed) / len(image), "lz4 HC" if lz4 else "built-in"))
+    if args.read_rate:
+        saved = (len(image) - len(packed)) / (args.read_rate * 1024.0)
+        print("estimated read time saved: %.2f s at %.0f KB/s, to weigh against DecodeTime of SimpleSD_GetStatistics()" % (
+            saved, args.read_rate))
+
+
+if __name__ == "__main__":
+    main()
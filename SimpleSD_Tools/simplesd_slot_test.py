@@ -0,0 +1,282 @@
+#!/usr/bin/env python3
+"""Host test of the A/B slot selection of the dual bank layout.
+
+The slot functions of SimpleSD_bootloader.c are compiled on the host with the
+definitions of SimpleSD_bootloader.h [first MCU of the header, SIMPLESD_DUAL_BANK
+branch]. The flash is emulated by memory mapped at its address, the slots are
+filled with images made by simplesd_image.py. Covers the choice of the newest
+slot, the wrap around of the sequence numbers, the fallback from a damaged
+slot and the sequence number programmed at the end of an upgrade. Needs gcc.
+"""
+
+import ctypes
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import simplesd_image  # noqa: E402
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "SimpleSD_Bootloader_Library")
+SOURCE = os.path.join(ROOT, "Src", "SimpleSD_bootloader.c")
+HEADER = os.path.join(ROOT, "Inc", "SimpleSD_bootloader.h")
+
+# SIMPLESD_SLOT_A_ADDRESS and SIMPLESD_SLOT_B_ADDRESS [sectors 5 and 17]
+SLOT_A_ADDRESS = 0x08020000
+SLOT_B_ADDRESS = 0x08120000
+
+FUNCTIONS = ["SimpleSD_ImageSizeFromHeader", "SimpleSD_SlotImageSize", "SimpleSD_SlotCRC_Check",
+             "SimpleSD_SlotSequence", "SimpleSD_SequenceNewer", "SimpleSD_SequenceNext",
+             "SimpleSD_ActiveSlot", "SimpleSD_CRC_Check", "SimpleSD_EraseAhead", "SimpleSD_UpgradeFinish"]
+DEFINES = re.compile(r"^\s*#define\s+((?:ADDR_FLASH_SECTOR|SIMPLESD_SLOT|SIMPLESD_IMAGE|APPLICATION)_\w+)\s+(.*?)\s*(?:/\*.*)?$")
+
+HARNESS = """
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SIMPLESD_DUAL_BANK 1
+#define SIMPLESD_PIPELINE_ENABLED 1
+#define SIMPLESD_ERASE_OVERLAP 0
+#define SIMPLESD_JOURNAL 0
+%(defines)s
+enum { SIMPLESD_CRC_SAME = 0, SIMPLESD_CRC_ERROR = 1 };
+enum { SIMPLESD_OK = 0, SIMPLESD_FLASH_ERASE_ERROR = 5, SIMPLESD_FLASH_WRITE_ERROR = 6 };
+enum { HAL_OK = 0 };
+#define FLASH_TYPEPROGRAM_WORD 2
+
+static uint32_t Slot_Active;
+static uint32_t Erase_Next;
+static struct { uint32_t WaitTime, EraseTime; } SimpleSD_Statistics;
+/* The FLASH interrupt drives the erase with the pipeline enabled */
+int Flash_IRQ;
+#define HAL_NVIC_DisableIRQ(IRQn) (Flash_IRQ = 0)
+uint32_t SimpleSD_SlotImageSize(uint32_t Base);
+uint32_t SimpleSD_SlotSequence(uint32_t Base);
+uint8_t SimpleSD_SequenceNewer(uint32_t Sequence, uint32_t Other);
+uint32_t SimpleSD_ImageSizeFromHeader(const uint32_t *Header);
+
+/* Bitwise CRC of the STM32 CRC unit */
+uint32_t SimpleSD_CRC_Update(uint32_t Crc, const uint32_t *Data, uint32_t Words)
+{
+	while(Words--) {
+		Crc ^= *Data++;
+		for(int i = 0; i < 32; i++) {
+			Crc = (Crc & 0x80000000) ? ((Crc << 1) ^ 0x04C11DB7) : (Crc << 1);
+		}
+	}
+	return Crc;
+}
+
+/* STM32F429: 4 x 16 KB, 64 KB and 7 x 128 KB sectors in each bank */
+static uint32_t Sector_Base(uint32_t Sector)
+{
+	uint32_t Base = 0x08000000;
+
+	for(uint32_t i = 0; i < Sector; i++) {
+		Base += ((i %% 12) < 4) ? 0x4000 : (((i %% 12) == 4) ? 0x10000 : 0x20000);
+	}
+	return Base;
+}
+
+uint32_t SimpleSD_FindSector(uint32_t Address)
+{
+	uint32_t Sector = 0;
+
+	while(Sector_Base(Sector + 1) <= Address) {
+		Sector++;
+	}
+	return Sector;
+}
+
+uint32_t SimpleSD_SectorEnd(uint32_t Address)
+{
+	return Sector_Base(SimpleSD_FindSector(Address) + 1);
+}
+
+/* Without the interrupt an erase never ends and the wait times out */
+uint8_t SimpleSD_EraseSectors(uint32_t FirstSector, uint32_t LastSector)
+{
+	if(!Flash_IRQ) {
+		return SIMPLESD_FLASH_ERASE_ERROR;
+	}
+	memset((void *)Sector_Base(FirstSector), 0xFF, Sector_Base(LastSector + 1) - Sector_Base(FirstSector));
+	return SIMPLESD_OK;
+}
+
+int HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	*(uint32_t *)Address &= (uint32_t)Data;
+	return HAL_OK;
+}
+
+uint8_t SimpleSD_ProgramWait(void) { return SIMPLESD_OK; }
+uint32_t SimpleSD_TimeStamp(void) { return 0; }
+uint32_t SimpleSD_ElapsedTime(uint32_t Start) { return 0; }
+void SimpleSD_FlashCacheReset(void) {}
+
+%(functions)s
+
+int flash_map(void)
+{
+	void *flash = mmap((void *)0x08000000, 0x00200000, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	return flash == (void *)0x08000000;
+}
+
+void slot_reset(void)
+{
+	Slot_Active = 0;
+}
+
+void erase_reset(uint32_t Address)
+{
+	Erase_Next = Address;
+	Flash_IRQ = 1;
+}
+"""
+
+
+def extract(source, name):
+    match = re.search(r"^(?:static )?\w+ \**%s\([^;{]*\)\n\{.*?\n\}\n" % name, source, re.S | re.M)
+    if match is None:
+        raise LookupError("%s not found in SimpleSD_bootloader.c" % name)
+    # Exported for ctypes
+    return re.sub(r"^static ", "", match.group(0))
+
+
+def defines(header):
+    found = {}
+    for line in header.splitlines():
+        match = DEFINES.match(line)
+        if match and match.group(1) not in found:
+            found[match.group(1)] = match.group(2)
+    return "\n".join("#define %s %s" % item for item in found.items())
+
+
+def build():
+    with open(SOURCE) as f:
+        source = f.read()
+    with open(HEADER) as f:
+        header = f.read()
+    code = HARNESS % {"defines": defines(header), "functions": "\n".join(extract(source, n) for n in FUNCTIONS)}
+    directory = tempfile.mkdtemp()
+    library = os.path.join(directory, "slots.so")
+    with open(os.path.join(directory, "slots.c"), "w") as f:
+        f.write(code)
+    subprocess.check_call(["gcc", "-shared", "-fPIC", "-O1", "-w", "-o", library, f.name])
+    return ctypes.CDLL(library)
+
+
+class SlotTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = build()
+        cls.lib.SimpleSD_ActiveSlot.restype = ctypes.c_uint32
+        cls.lib.SimpleSD_CRC_Check.restype = ctypes.c_uint8
+        cls.lib.SimpleSD_SequenceNext.restype = ctypes.c_uint32
+        cls.lib.SimpleSD_SequenceNext.argtypes = [ctypes.c_uint32]
+        if not cls.lib.flash_map():
+            raise unittest.SkipTest("flash address range not available on this host")
+        cls.slot_a = SLOT_A_ADDRESS
+        cls.slot_b = SLOT_B_ADDRESS
+
+    def install(self, base, sequence, version=1, damaged=False, vectors=(0x20030000, 0x08020101), size=0x1000):
+        app = bytearray(struct.pack("<2I", *vectors) + os.urandom(size - 8))
+        app[0x1C:0x2C] = bytes(16)
+        image = bytearray(simplesd_image.build_image(bytes(app), version, block_crc=False))
+        if damaged:
+            image[0x800] ^= 0x01
+        if sequence is not None:
+            image += struct.pack("<I", sequence)
+        ctypes.memset(base, 0xFF, len(image) + 0x1000)
+        ctypes.memmove(base, bytes(image), len(image))
+        return base + len(image)
+
+    def erase(self, base):
+        ctypes.memset(base, 0xFF, 0x2000)
+
+    def active(self):
+        self.lib.slot_reset()
+        return self.lib.SimpleSD_ActiveSlot()
+
+    def test_newest_slot(self):
+        self.install(self.slot_a, 1)
+        self.erase(self.slot_b)
+        self.assertEqual(self.active(), self.slot_a)
+        self.install(self.slot_b, 2)
+        self.assertEqual(self.active(), self.slot_b)
+        self.install(self.slot_a, 3)
+        self.assertEqual(self.active(), self.slot_a)
+
+    def test_empty_flash(self):
+        self.erase(self.slot_a)
+        self.erase(self.slot_b)
+        self.assertEqual(self.active(), self.slot_a)
+        self.assertEqual(self.lib.SimpleSD_CRC_Check(), 1)
+
+    def test_sequence_rollover(self):
+        self.assertEqual(self.lib.SimpleSD_SequenceNext(0), 1)
+        self.assertEqual(self.lib.SimpleSD_SequenceNext(0xFFFFFFFD), 0xFFFFFFFE)
+        self.assertEqual(self.lib.SimpleSD_SequenceNext(0xFFFFFFFE), 1)
+        self.install(self.slot_a, 0xFFFFFFFE)
+        self.install(self.slot_b, self.lib.SimpleSD_SequenceNext(0xFFFFFFFE))
+        self.assertEqual(self.active(), self.slot_b)
+        self.install(self.slot_a, self.lib.SimpleSD_SequenceNext(1))
+        self.assertEqual(self.active(), self.slot_a)
+
+    def test_insane_vector_table(self):
+        self.install(self.slot_a, 1)
+        self.install(self.slot_b, 2, vectors=(0xFFFFFFFF, 0x08020101))
+        self.assertEqual(self.active(), self.slot_a)
+        self.install(self.slot_b, 2, vectors=(0x20030000, 0x00000101))
+        self.assertEqual(self.active(), self.slot_a)
+
+    def test_damaged_slot_fallback(self):
+        self.install(self.slot_a, 1)
+        self.install(self.slot_b, 2, damaged=True)
+        self.assertEqual(self.active(), self.slot_b)
+        self.assertEqual(self.lib.SimpleSD_CRC_Check(), 0)
+        self.assertEqual(self.lib.SimpleSD_ActiveSlot(), self.slot_a)
+
+    def test_both_slots_damaged(self):
+        self.install(self.slot_a, 1, damaged=True)
+        self.install(self.slot_b, 2, damaged=True)
+        self.active()
+        self.assertEqual(self.lib.SimpleSD_CRC_Check(), 1)
+
+    def test_no_fallback_to_uninstalled_slot(self):
+        self.install(self.slot_a, 0xFFFFFFFF)
+        self.install(self.slot_b, 2, damaged=True)
+        self.active()
+        self.assertEqual(self.lib.SimpleSD_CRC_Check(), 1)
+
+    def test_sequence_in_next_sector(self):
+        # Image and CRC fill sector 17, the sequence number starts sector 18 over an old firmware
+        self.install(self.slot_a, 5)
+        end = self.install(self.slot_b, None, size=0x20000 - 4)
+        self.assertEqual(end, self.slot_b + 0x20000)
+        ctypes.memset(end, 0x00, 0x100)
+        self.lib.slot_reset()
+        self.lib.erase_reset(end)
+        self.assertEqual(self.lib.SimpleSD_UpgradeFinish(end), 0)
+        self.assertEqual(ctypes.c_uint32.from_address(end).value, 6)
+        self.assertEqual(ctypes.c_int.in_dll(self.lib, "Flash_IRQ").value, 0)
+        self.assertEqual(self.lib.SimpleSD_ActiveSlot(), self.slot_b)
+
+    def test_sequence_in_erased_sector(self):
+        self.install(self.slot_a, 5)
+        end = self.install(self.slot_b, None)
+        self.lib.slot_reset()
+        self.lib.erase_reset(self.slot_b + 0x20000)
+        self.assertEqual(self.lib.SimpleSD_UpgradeFinish(end), 0)
+        self.assertEqual(ctypes.c_uint32.from_address(end).value, 6)
+        self.assertEqual(self.lib.SimpleSD_ActiveSlot(), self.slot_b)
+
+
+if __name__ == "__main__":
+    unittest.main()